@@ -0,0 +1,262 @@
+#include "ec_system.hpp"
+#include "ec_system_scheduler.hpp"
+#include "json.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+ * Micro-benchmarks for ec_system.hpp. Prints one JSON object with the results to stdout.
+ *
+ *     glome_bench_ecs [max_num_entities] [repetitions]
+ *
+ * Every operation is measured for 10^3 up to max_num_entities (default 10^6) entities, 1 to 8 components and
+ * different densities. The first component is created for every entity, each of the other components only for the
+ * given fraction of entities (chosen at random), so lower densities spread the entities over more archetypes.
+ * Queries ask for all components. Query timings are the minimum over all repetitions.
+ *
+ * Before measuring, it checks that change detection doesn't miss components that are changed outside of the waves
+ * of a SystemScheduler.
+ */
+
+using json = nlohmann::json;
+using namespace ec_system;
+
+template<size_t N>
+struct BenchComponent
+{
+    float value[4];
+};
+
+namespace
+{
+    constexpr size_t max_num_components = 8;
+
+    using Clock = std::chrono::steady_clock;
+
+    // written after the query loops, so that the compiler can't drop them
+    volatile float sink = 0.0f;
+
+    double secondsSince(const Clock::time_point start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    struct Config
+    {
+        size_t num_entities;
+        size_t num_components;
+        double density;
+    };
+
+    class Results
+    {
+    public:
+        void add(const std::string& operation, const Config& config, const size_t num_processed, const double seconds)
+        {
+            m_results.push_back(
+                {
+                    {"operation", operation},
+                    {"num_entities", config.num_entities},
+                    {"num_components", config.num_components},
+                    {"density", config.density},
+                    {"num_processed", num_processed},
+                    {"total_ns", seconds * 1e9},
+                    {"ns_per_item", num_processed > 0 ? seconds * 1e9 / double(num_processed) : 0.0}
+                }
+            );
+        }
+
+        json toJson() const
+        {
+            return json{{"benchmark", "ec_system"}, {"results", m_results}};
+        }
+
+    private:
+        json m_results = json::array();
+    };
+
+    template<size_t... Is>
+    void runConfig(const Config& config, const size_t repetitions, Results& results, std::index_sequence<Is...>)
+    {
+        EntityManager entity_manager;
+        std::mt19937 rng(12345);
+        std::bernoulli_distribution has_component(config.density);
+
+        auto start = Clock::now();
+        std::vector<Entity> entities;
+        entities.reserve(config.num_entities);
+        for (size_t i = 0; i < config.num_entities; ++i)
+        {
+            entities.push_back(entity_manager.createEntity());
+        }
+        results.add("createEntity", config, config.num_entities, secondsSince(start));
+
+        // decided up front, so that the random numbers are not part of the measurement
+        std::vector<std::vector<bool>> component_masks(config.num_entities);
+        size_t num_components_created = 0;
+        for (auto& mask : component_masks)
+        {
+            mask = {(Is == 0 || has_component(rng))...};
+            num_components_created += std::count(mask.begin(), mask.end(), true);
+        }
+
+        start = Clock::now();
+        for (size_t i = 0; i < config.num_entities; ++i)
+        {
+            ((component_masks[i][Is] ? entity_manager.createComponent<BenchComponent<Is>>(
+                entities[i], BenchComponent<Is>{{float(i), 0.0f, 0.0f, 0.0f}}
+            ) : void()), ...);
+        }
+        results.add("createComponent", config, num_components_created, secondsSince(start));
+
+        double best_iterator = 0.0;
+        double best_each = 0.0;
+        size_t num_matches = 0;
+        float sum = 0.0f;
+        for (size_t repetition = 0; repetition < repetitions; ++repetition)
+        {
+            start = Clock::now();
+            num_matches = 0;
+            for (const auto entity : entity_manager.iterator<BenchComponent<Is>...>())
+            {
+                sum += (entity_manager.getUnchecked<BenchComponent<Is>>(entity).value[0] + ...);
+                num_matches += 1;
+            }
+            const double iterator_seconds = secondsSince(start);
+
+            start = Clock::now();
+            entity_manager.each<BenchComponent<Is>...>().run(
+                [&sum](BenchComponent<Is>& ... components)
+                {
+                    sum += (components.value[0] + ...);
+                }
+            );
+            const double each_seconds = secondsSince(start);
+
+            if (repetition == 0 || iterator_seconds < best_iterator)
+            {
+                best_iterator = iterator_seconds;
+            }
+            if (repetition == 0 || each_seconds < best_each)
+            {
+                best_each = each_seconds;
+            }
+        }
+        sink = sum;
+        results.add("iterator", config, num_matches, best_iterator);
+        results.add("each.run", config, num_matches, best_each);
+
+        // removes the component every entity has, so every entity is moved to another archetype
+        start = Clock::now();
+        for (const auto entity : entities)
+        {
+            entity_manager.removeComponent<BenchComponent<0>>(entity);
+        }
+        results.add("removeComponent", config, config.num_entities, secondsSince(start));
+    }
+
+    template<size_t NumComponents>
+    void runConfig(const Config& config, const size_t repetitions, Results& results)
+    {
+        runConfig(config, repetitions, results, std::make_index_sequence<NumComponents>{});
+    }
+
+    // A system in the last wave has to see the components created by the command buffer of the scheduler and the
+    // components that are marked as changed between two runs.
+    void checkChangeDetection()
+    {
+        using Changed = BenchComponent<0>;
+        EntityManager entity_manager;
+        SystemScheduler scheduler(entity_manager);
+        bool spawn = true;
+        scheduler.addSystem(
+            "spawn", Reads<>{}, Writes<Changed>{},
+            [&]
+            {
+                if (spawn)
+                {
+                    spawn = false;
+                    auto& command_buffer = scheduler.getCommandBuffer();
+                    command_buffer.createComponent<Changed>(command_buffer.createEntity());
+                }
+            }
+        );
+        uint32_t since = entity_manager.getChangeTick();
+        size_t num_changed = 0;
+        scheduler.addSystem(
+            "consume", Reads<Changed>{}, Writes<>{},
+            [&]
+            {
+                entity_manager.each<Changed>().changedSince<Changed>(since).run(
+                    [&](const Changed&)
+                    {
+                        num_changed += 1;
+                    }
+                );
+                since = entity_manager.getChangeTick();
+            }
+        );
+
+        scheduler.run();
+        scheduler.run();
+        if (num_changed != 1)
+        {
+            throw std::runtime_error(
+                std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                "Component created by the command buffer hasn't been detected as changed.");
+        }
+        for (const auto entity : entity_manager.iterator<Changed>())
+        {
+            entity_manager.markChanged<Changed>(entity);
+        }
+        scheduler.run();
+        if (num_changed != 2)
+        {
+            throw std::runtime_error(
+                std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                "Component marked as changed between two runs hasn't been detected as changed.");
+        }
+    }
+
+    template<size_t... Ns>
+    void runAllComponentCounts(
+        const size_t num_entities,
+        const double density,
+        const size_t repetitions,
+        Results& results,
+        std::index_sequence<Ns...>
+    )
+    {
+        ((
+            Ns + 1 == 1 || Ns + 1 == 2 || Ns + 1 == 4 || Ns + 1 == 8 ?
+            runConfig<Ns + 1>({num_entities, Ns + 1, density}, repetitions, results) : void()
+        ), ...);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const size_t max_num_entities = argc > 1 ? std::stoul(argv[1]) : 1'000'000;
+    const size_t repetitions = argc > 2 ? std::max<size_t>(std::stoul(argv[2]), 1) : 5;
+
+    checkChangeDetection();
+
+    Results results;
+    for (size_t num_entities = 1000; num_entities <= max_num_entities; num_entities *= 10)
+    {
+        for (const double density : {1.0, 0.5, 0.1})
+        {
+            runAllComponentCounts(
+                num_entities, density, repetitions, results, std::make_index_sequence<max_num_components>{}
+            );
+        }
+    }
+    std::cout << results.toJson().dump(4) << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,768 @@
+#include "shared_glm_glsl.h"
+#include "json.hpp"
+#include <glm/gtx/transform.hpp>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+ * Compares cross3(), orthogonalPlane(), plane() and getLocalDirectionalVector() of shared_glm_glsl.h with their
+ * previous versions, getViewAnglesAtan2() with getViewAngles() and getCoord() from a model frame with getCoord() from a
+ * hypersphere and local orientation. Prints one JSON object with the results to stdout. The polynomial approximations
+ * approx_sin(), approx_cos() and approx_acos() are compared with the standard library on evenly spaced inputs, their
+ * errors are given in radians and in ULPs of the correctly rounded float result.
+ *
+ *     glome_bench_hs_math [num_inputs] [repetitions]
+ *
+ * "random" inputs are uniformly distributed on the unit hypersphere. "axis_aligned" inputs start at the origin of
+ * the world, towards coordinates with x = y = 0, which the previous formulas couldn't handle. Errors are the largest
+ * difference of a component to a double precision reference, non finite results are counted separately.
+ * For the view angles the errors are the largest differences of the angles and of the distance divided by the radius,
+ * to a double precision reference and between both versions.
+ */
+
+using json = nlohmann::json;
+
+// the symbolic solver output that was used before
+namespace legacy
+{
+    using namespace glm;
+    using glm::hs::safe_acos;
+
+    inline vec4 cross3(const vec4 a, const vec4 b, const vec4 c)
+    {
+        vec4 ret;
+        ret.x = (a.w * b.y * c.z - a.w * b.z * c.y - a.y * b.w * c.z + a.y * b.z * c.w + a.z * b.w * c.y - a.z * b.y * c.w) /
+                (a.w * b.x * c.y - a.w * b.y * c.x - a.x * b.w * c.y + a.x * b.y * c.w + a.y * b.w * c.x - a.y * b.x * c.w
+                 - a.w * b.x * c.z + a.w * b.z * c.x + a.x * b.w * c.z - a.x * b.z * c.w - a.z * b.w * c.x + a.z * b.x * c.w
+                 + a.w * b.y * c.z - a.w * b.z * c.y - a.y * b.w * c.z + a.y * b.z * c.w + a.z * b.w * c.y - a.z * b.y * c.w
+                 - a.x * b.y * c.z + a.x * b.z * c.y + a.y * b.x * c.z - a.y * b.z * c.x - a.z * b.x * c.y + a.z * b.y * c.x);
+        ret.y = -(a.w * b.x * c.z - a.w * b.z * c.x - a.x * b.w * c.z + a.x * b.z * c.w + a.z * b.w * c.x - a.z * b.x * c.w) /
+                (a.w * b.x * c.y - a.w * b.y * c.x - a.x * b.w * c.y + a.x * b.y * c.w + a.y * b.w * c.x - a.y * b.x * c.w
+                 - a.w * b.x * c.z + a.w * b.z * c.x + a.x * b.w * c.z - a.x * b.z * c.w - a.z * b.w * c.x + a.z * b.x * c.w
+                 + a.w * b.y * c.z - a.w * b.z * c.y - a.y * b.w * c.z + a.y * b.z * c.w + a.z * b.w * c.y - a.z * b.y * c.w
+                 - a.x * b.y * c.z + a.x * b.z * c.y + a.y * b.x * c.z - a.y * b.z * c.x - a.z * b.x * c.y + a.z * b.y * c.x);
+        ret.z = (a.w * b.x * c.y - a.w * b.y * c.x - a.x * b.w * c.y + a.x * b.y * c.w + a.y * b.w * c.x - a.y * b.x * c.w) /
+                (a.w * b.x * c.y - a.w * b.y * c.x - a.x * b.w * c.y + a.x * b.y * c.w + a.y * b.w * c.x - a.y * b.x * c.w
+                 - a.w * b.x * c.z + a.w * b.z * c.x + a.x * b.w * c.z - a.x * b.z * c.w - a.z * b.w * c.x + a.z * b.x * c.w
+                 + a.w * b.y * c.z - a.w * b.z * c.y - a.y * b.w * c.z + a.y * b.z * c.w + a.z * b.w * c.y - a.z * b.y * c.w
+                 - a.x * b.y * c.z + a.x * b.z * c.y + a.y * b.x * c.z - a.y * b.z * c.x - a.z * b.x * c.y + a.z * b.y * c.x);
+        ret.w = -(a.x * b.y * c.z - a.x * b.z * c.y - a.y * b.x * c.z + a.y * b.z * c.x + a.z * b.x * c.y - a.z * b.y * c.x) /
+                (a.w * b.x * c.y - a.w * b.y * c.x - a.x * b.w * c.y + a.x * b.y * c.w + a.y * b.w * c.x - a.y * b.x * c.w
+                 - a.w * b.x * c.z + a.w * b.z * c.x + a.x * b.w * c.z - a.x * b.z * c.w - a.z * b.w * c.x + a.z * b.x * c.w
+                 + a.w * b.y * c.z - a.w * b.z * c.y - a.y * b.w * c.z + a.y * b.z * c.w + a.z * b.w * c.y - a.z * b.y * c.w
+                 - a.x * b.y * c.z + a.x * b.z * c.y + a.y * b.x * c.z - a.y * b.z * c.x - a.z * b.x * c.y + a.z * b.y * c.x);
+
+        ret = normalize(ret);
+        return ret;
+    }
+
+    //finds plane that is orthogonal to t and v
+    inline mat2x4 orthogonalPlane(const vec4 t, const vec4 v)
+    {
+        mat2x4 ret;
+        ret[0].x = -(t.w * v.y - t.y * v.w + t.y * v.z - t.z * v.y) /
+                   (t.w * v.x - t.x * v.w - t.w * v.y + t.y * v.w + t.x * v.z - t.z * v.x - t.y * v.z + t.z * v.y);
+        ret[0].y = (t.w * v.x - t.x * v.w + t.x * v.z - t.z * v.x) /
+                   (t.w * v.x - t.x * v.w - t.w * v.y + t.y * v.w + t.x * v.z - t.z * v.x - t.y * v.z + t.z * v.y);
+        ret[0].z = -(t.x * v.y - t.y * v.x) / (t.w * v.x - t.x * v.w - t.w * v.y + t.y * v.w + t.x * v.z - t.z * v.x - t.y * v.z + t.z * v.y);
+        ret[0].w = (t.x * v.y - t.y * v.x) / (t.w * v.x - t.x * v.w - t.w * v.y + t.y * v.w + t.x * v.z - t.z * v.x - t.y * v.z + t.z * v.y);
+        float sigma_1 = t.x * t.z * v.y * v.y;
+        float sigma_2 = t.x * t.z * v.w * v.w;
+        ret[1].x = -(v.x * t.w * t.w * v.z - v.x * t.w * t.y * v.y - v.x * t.w * t.z * v.w - v.x * t.w * t.z * v.z - t.x * t.w * v.w * v.z +
+                     t.x * t.w * v.y * v.y + t.x * t.w * v.z * v.z + v.x * t.y * t.y * v.w + v.x * t.y * t.y * v.z - v.x * t.y * t.z * v.y -
+                     t.x * t.y * v.w * v.y - t.x * t.y * v.y * v.z + v.x * t.z * t.z * v.w + sigma_2 - t.x * t.z * v.w * v.z + sigma_1) /
+                   (t.w * t.w * v.x * v.x - t.w * t.w * v.x * v.z + t.w * t.w * v.y * v.y - t.w * t.w * v.y * v.z - 2 * t.w * t.x * v.w * v.x +
+                    t.w * t.x * v.w * v.z + t.w * t.x * v.x * v.y + 2 * t.w * t.x * v.x * v.z - t.w * t.x * v.y * v.y - t.w * t.x * v.z * v.z -
+                    2 * t.w * t.y * v.w * v.y + t.w * t.y * v.w * v.z - t.w * t.y * v.x * v.x + t.w * t.y * v.x * v.y + 2 * t.w * t.y * v.y * v.z -
+                    t.w * t.y * v.z * v.z + t.w * t.z * v.w * v.x + t.w * t.z * v.w * v.y - 2 * t.w * t.z * v.x * v.x + t.w * t.z * v.x * v.z -
+                    2 * t.w * t.z * v.y * v.y + t.w * t.z * v.y * v.z + t.x * t.x * v.w * v.w - t.x * t.x * v.w * v.y - 2 * t.x * t.x * v.w * v.z +
+                    2 * t.x * t.x * v.y * v.y - t.x * t.x * v.y * v.z + t.x * t.x * v.z * v.z + t.x * t.y * v.w * v.x + t.x * t.y * v.w * v.y -
+                    4 * t.x * t.y * v.x * v.y + t.x * t.y * v.x * v.z + t.x * t.y * v.y * v.z - sigma_2 + 2 * t.x * t.z * v.w * v.x +
+                    t.x * t.z * v.w * v.z + t.x * t.z * v.x * v.y - 2 * t.x * t.z * v.x * v.z - sigma_1 + t.y * t.y * v.w * v.w -
+                    t.y * t.y * v.w * v.x - 2 * t.y * t.y * v.w * v.z + 2 * t.y * t.y * v.x * v.x - t.y * t.y * v.x * v.z + t.y * t.y * v.z * v.z -
+                    t.y * t.z * v.w * v.w + 2 * t.y * t.z * v.w * v.y + t.y * t.z * v.w * v.z - t.y * t.z * v.x * v.x + t.y * t.z * v.x * v.y -
+                    2 * t.y * t.z * v.y * v.z - t.z * t.z * v.w * v.x - t.z * t.z * v.w * v.y + t.z * t.z * v.x * v.x + t.z * t.z * v.y * v.y);
+        float sigma_3 = t.y * t.z * v.x * v.x;
+        float sigma_4 = t.y * t.z * v.w * v.w;
+        ret[1].y = -(v.y * t.w * t.w * v.z - v.y * t.w * t.x * v.x - v.y * t.w * t.z * v.w - v.y * t.w * t.z * v.z - t.y * t.w * v.w * v.z +
+                     t.y * t.w * v.x * v.x + t.y * t.w * v.z * v.z + v.y * t.x * t.x * v.w + v.y * t.x * t.x * v.z - v.y * t.x * t.z * v.x -
+                     t.y * t.x * v.w * v.x - t.y * t.x * v.x * v.z + v.y * t.z * t.z * v.w + sigma_4 - t.y * t.z * v.w * v.z + sigma_3) /
+                   (t.w * t.w * v.x * v.x - t.w * t.w * v.x * v.z + t.w * t.w * v.y * v.y - t.w * t.w * v.y * v.z - 2 * t.w * t.x * v.w * v.x +
+                    t.w * t.x * v.w * v.z + t.w * t.x * v.x * v.y + 2 * t.w * t.x * v.x * v.z - t.w * t.x * v.y * v.y - t.w * t.x * v.z * v.z -
+                    2 * t.w * t.y * v.w * v.y + t.w * t.y * v.w * v.z - t.w * t.y * v.x * v.x + t.w * t.y * v.x * v.y + 2 * t.w * t.y * v.y * v.z -
+                    t.w * t.y * v.z * v.z + t.w * t.z * v.w * v.x + t.w * t.z * v.w * v.y - 2 * t.w * t.z * v.x * v.x + t.w * t.z * v.x * v.z -
+                    2 * t.w * t.z * v.y * v.y + t.w * t.z * v.y * v.z + t.x * t.x * v.w * v.w - t.x * t.x * v.w * v.y - 2 * t.x * t.x * v.w * v.z +
+                    2 * t.x * t.x * v.y * v.y - t.x * t.x * v.y * v.z + t.x * t.x * v.z * v.z + t.x * t.y * v.w * v.x + t.x * t.y * v.w * v.y -
+                    4 * t.x * t.y * v.x * v.y + t.x * t.y * v.x * v.z + t.x * t.y * v.y * v.z - t.x * t.z * v.w * v.w + 2 * t.x * t.z * v.w * v.x +
+                    t.x * t.z * v.w * v.z + t.x * t.z * v.x * v.y - 2 * t.x * t.z * v.x * v.z - t.x * t.z * v.y * v.y + t.y * t.y * v.w * v.w -
+                    t.y * t.y * v.w * v.x - 2 * t.y * t.y * v.w * v.z + 2 * t.y * t.y * v.x * v.x - t.y * t.y * v.x * v.z + t.y * t.y * v.z * v.z -
+                    sigma_4 + 2 * t.y * t.z * v.w * v.y + t.y * t.z * v.w * v.z - sigma_3 + t.y * t.z * v.x * v.y - 2 * t.y * t.z * v.y * v.z -
+                    t.z * t.z * v.w * v.x - t.z * t.z * v.w * v.y + t.z * t.z * v.x * v.x + t.z * t.z * v.y * v.y);
+        float sigma_5 = t.y * t.y * v.w * v.w;
+        float sigma_6 = t.w * t.w * v.y * v.y;
+        float sigma_7 = t.x * t.x * v.w * v.w;
+        float sigma_8 = t.w * t.w * v.x * v.x;
+        float sigma_9 = 2 * t.w * t.y * v.w * v.y;
+        float sigma_10 = 2 * t.w * t.x * v.w * v.x;
+        ret[1].z =
+            (sigma_8 + sigma_6 - sigma_10 + v.z * t.w * t.x * v.x - sigma_9 + v.z * t.w * t.y * v.y - t.z * t.w * v.x * v.x - t.z * t.w * v.y * v.y +
+             sigma_7 - v.z * t.x * t.x * v.w + t.x * t.x * v.y * v.y - 2 * t.x * t.y * v.x * v.y + t.z * t.x * v.w * v.x + sigma_5 -
+             v.z * t.y * t.y * v.w + t.y * t.y * v.x * v.x + t.z * t.y * v.w * v.y) /
+            (sigma_8 - t.w * t.w * v.x * v.z + sigma_6 - t.w * t.w * v.y * v.z - sigma_10 + t.w * t.x * v.w * v.z + t.w * t.x * v.x * v.y +
+             2 * t.w * t.x * v.x * v.z - t.w * t.x * v.y * v.y - t.w * t.x * v.z * v.z - sigma_9 + t.w * t.y * v.w * v.z - t.w * t.y * v.x * v.x +
+             t.w * t.y * v.x * v.y + 2 * t.w * t.y * v.y * v.z - t.w * t.y * v.z * v.z + t.w * t.z * v.w * v.x + t.w * t.z * v.w * v.y -
+             2 * t.w * t.z * v.x * v.x + t.w * t.z * v.x * v.z - 2 * t.w * t.z * v.y * v.y + t.w * t.z * v.y * v.z + sigma_7 - t.x * t.x * v.w * v.y -
+             2 * t.x * t.x * v.w * v.z + 2 * t.x * t.x * v.y * v.y - t.x * t.x * v.y * v.z + t.x * t.x * v.z * v.z + t.x * t.y * v.w * v.x +
+             t.x * t.y * v.w * v.y - 4 * t.x * t.y * v.x * v.y + t.x * t.y * v.x * v.z + t.x * t.y * v.y * v.z - t.x * t.z * v.w * v.w +
+             2 * t.x * t.z * v.w * v.x + t.x * t.z * v.w * v.z + t.x * t.z * v.x * v.y - 2 * t.x * t.z * v.x * v.z - t.x * t.z * v.y * v.y + sigma_5 -
+             t.y * t.y * v.w * v.x - 2 * t.y * t.y * v.w * v.z + 2 * t.y * t.y * v.x * v.x - t.y * t.y * v.x * v.z + t.y * t.y * v.z * v.z -
+             t.y * t.z * v.w * v.w + 2 * t.y * t.z * v.w * v.y + t.y * t.z * v.w * v.z - t.y * t.z * v.x * v.x + t.y * t.z * v.x * v.y -
+             2 * t.y * t.z * v.y * v.z - t.z * t.z * v.w * v.x - t.z * t.z * v.w * v.y + t.z * t.z * v.x * v.x + t.z * t.z * v.y * v.y);
+        float sigma_11 = t.z * t.z * v.y * v.y;
+        float sigma_12 = t.y * t.y * v.z * v.z;
+        float sigma_13 = t.z * t.z * v.x * v.x;
+        float sigma_14 = t.x * t.x * v.z * v.z;
+        float sigma_15 = 2 * t.y * t.z * v.y * v.z;
+        float sigma_16 = 2 * t.x * t.z * v.x * v.z;
+        ret[1].w = (t.x * t.x * v.y * v.y + sigma_14 - v.w * t.x * t.x * v.z - 2 * t.x * t.y * v.x * v.y - sigma_16 + v.w * t.x * t.z * v.x +
+                    t.w * t.x * v.x * v.z + t.y * t.y * v.x * v.x + sigma_12 - v.w * t.y * t.y * v.z - sigma_15 + v.w * t.y * t.z * v.y +
+                    t.w * t.y * v.y * v.z + sigma_13 + sigma_11 - t.w * t.z * v.x * v.x - t.w * t.z * v.y * v.y) /
+                   (t.w * t.w * v.x * v.x - t.w * t.w * v.x * v.z + t.w * t.w * v.y * v.y - t.w * t.w * v.y * v.z - 2 * t.w * t.x * v.w * v.x +
+                    t.w * t.x * v.w * v.z + t.w * t.x * v.x * v.y + 2 * t.w * t.x * v.x * v.z - t.w * t.x * v.y * v.y - t.w * t.x * v.z * v.z -
+                    2 * t.w * t.y * v.w * v.y + t.w * t.y * v.w * v.z - t.w * t.y * v.x * v.x + t.w * t.y * v.x * v.y + 2 * t.w * t.y * v.y * v.z -
+                    t.w * t.y * v.z * v.z + t.w * t.z * v.w * v.x + t.w * t.z * v.w * v.y - 2 * t.w * t.z * v.x * v.x + t.w * t.z * v.x * v.z -
+                    2 * t.w * t.z * v.y * v.y + t.w * t.z * v.y * v.z + t.x * t.x * v.w * v.w - t.x * t.x * v.w * v.y - 2 * t.x * t.x * v.w * v.z +
+                    2 * t.x * t.x * v.y * v.y - t.x * t.x * v.y * v.z + sigma_14 + t.x * t.y * v.w * v.x + t.x * t.y * v.w * v.y -
+                    4 * t.x * t.y * v.x * v.y + t.x * t.y * v.x * v.z + t.x * t.y * v.y * v.z - t.x * t.z * v.w * v.w + 2 * t.x * t.z * v.w * v.x +
+                    t.x * t.z * v.w * v.z + t.x * t.z * v.x * v.y - sigma_16 - t.x * t.z * v.y * v.y + t.y * t.y * v.w * v.w - t.y * t.y * v.w * v.x -
+                    2 * t.y * t.y * v.w * v.z + 2 * t.y * t.y * v.x * v.x - t.y * t.y * v.x * v.z + sigma_12 - t.y * t.z * v.w * v.w +
+                    2 * t.y * t.z * v.w * v.y + t.y * t.z * v.w * v.z - t.y * t.z * v.x * v.x + t.y * t.z * v.x * v.y - sigma_15 -
+                    t.z * t.z * v.w * v.x - t.z * t.z * v.w * v.y + sigma_13 + sigma_11);
+
+        return ret;
+    }
+
+    // finds plane that lies in t and v
+    inline mat2x4 plane(const vec4 t, const vec4 v)
+    {
+        mat2x4 ret;
+        ret[0] = v;
+        ret[1].x = (t.x * v.w * v.w - t.w * v.x * v.w + t.x * v.y * v.y - t.y * v.x * v.y + t.x * v.z * v.z - t.z * v.x * v.z) /
+                   (v.w * v.w + v.x * v.x + v.y * v.y + v.z * v.z);
+        ret[1].y = (t.y * v.w * v.w - t.w * v.y * v.w + t.y * v.x * v.x - t.x * v.y * v.x + t.y * v.z * v.z - t.z * v.y * v.z) /
+                   (v.w * v.w + v.x * v.x + v.y * v.y + v.z * v.z);
+        ret[1].z = (t.z * v.w * v.w - t.w * v.z * v.w + t.z * v.x * v.x - t.x * v.z * v.x + t.z * v.y * v.y - t.y * v.z * v.y) /
+                   (v.w * v.w + v.x * v.x + v.y * v.y + v.z * v.z);
+        ret[1].w = (t.w * v.x * v.x - t.x * v.w * v.x + t.w * v.y * v.y - t.y * v.w * v.y + t.w * v.z * v.z - t.z * v.w * v.z) /
+                   (v.w * v.w + v.x * v.x + v.y * v.y + v.z * v.z);
+        ret[0] = normalize(ret[0]);
+        ret[1] = normalize(ret[1]);
+        return ret;
+    }
+    inline vec4 getLocalDirectionalVector(const vec4 from_coord, const vec4 to_coord)
+    {
+        mat2x4 axis = orthogonalPlane(from_coord, to_coord);
+        vec4 local_direction = normalize(cross3(axis[0], axis[1], from_coord));
+        float angle = safe_acos(dot(local_direction, normalize(to_coord - from_coord)));
+        if (radians(90.0f) < angle && angle <= radians(180.0f))
+        {
+            local_direction = -local_direction;
+        }
+        return local_direction;
+    }
+}
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    // written after the timed loops, so that the compiler can't drop them
+    volatile float sink = 0.0f;
+
+    struct Input
+    {
+        glm::vec4 a;
+        glm::vec4 b;
+        glm::vec4 c;
+    };
+
+    glm::dvec4 reference(const glm::vec4 v)
+    {
+        return glm::dvec4(v);
+    }
+
+    glm::dvec4 referenceCross3(const glm::dvec4 a, const glm::dvec4 b, const glm::dvec4 c)
+    {
+        glm::dvec4 ret;
+        for (int i = 0; i < 4; ++i)
+        {
+            // cofactor of the entry i of the last row of the matrix (a, b, c, x)
+            glm::dmat3 minor;
+            for (int j = 0, column = 0; j < 4; ++j)
+            {
+                if (j != i)
+                {
+                    minor[column] = glm::dvec3(a[j], b[j], c[j]);
+                    column += 1;
+                }
+            }
+            ret[i] = ((i + 3) % 2 == 0 ? 1.0 : -1.0) * glm::determinant(minor);
+        }
+        if (ret.x + ret.y + ret.z + ret.w < 0.0)
+        {
+            ret = -ret;
+        }
+        return glm::normalize(ret);
+    }
+
+    glm::dvec4 referenceLocalDirectionalVector(const glm::dvec4 from, const glm::dvec4 to)
+    {
+        const glm::dvec4 from_axis = glm::normalize(from);
+        return glm::normalize(to - glm::dot(to, from_axis) * from_axis);
+    }
+
+    glm::dvec3 referenceViewAngles(
+        const glm::dmat3 camera_orientation,
+        const glm::dmat4 camera_hypersphere_orientation,
+        const glm::dvec4 object_coord,
+        const double radius
+    )
+    {
+        const glm::dvec3 local = glm::transpose(camera_orientation) * glm::dvec3(
+            glm::dot(object_coord, camera_hypersphere_orientation[0]),
+            glm::dot(object_coord, camera_hypersphere_orientation[1]),
+            glm::dot(object_coord, camera_hypersphere_orientation[2])
+        );
+        const double angle = std::atan2(glm::length(local), glm::dot(object_coord, camera_hypersphere_orientation[3]));
+        const double side = local.z < 0.0 ? -1.0 : 1.0;
+        return glm::dvec3(
+            std::atan2(side * local.x, side * local.z),
+            std::atan2(side * local.y, side * local.z),
+            radius * (glm::pi<double>() + side * (angle - glm::pi<double>()))
+        );
+    }
+
+    glm::dvec4 referenceCoord(
+        const glm::dmat4 hypersphere_orientation,
+        const glm::dmat3 local_orientation,
+        const glm::dvec3 offset,
+        const double radius
+    )
+    {
+        const glm::dvec4 direction = hypersphere_orientation * glm::dvec4(local_orientation * offset, 0.0);
+        const double offset_length = glm::length(offset);
+        if (offset_length == 0.0)
+        {
+            return hypersphere_orientation[3];
+        }
+        return std::cos(offset_length / radius) * hypersphere_orientation[3] +
+               std::sin(offset_length / radius) * direction / offset_length;
+    }
+
+    bool isFinite(const glm::vec4 v)
+    {
+        return std::isfinite(v.x) && std::isfinite(v.y) && std::isfinite(v.z) && std::isfinite(v.w);
+    }
+
+    double difference(const glm::vec4 v, const glm::dvec4 expected)
+    {
+        double ret = 0.0;
+        for (int i = 0; i < 4; ++i)
+        {
+            ret = std::max(ret, std::abs(double(v[i]) - expected[i]));
+        }
+        return ret;
+    }
+
+    // largest component of the projections of the normalized axes onto the normalized t and v
+    double orthogonality(const glm::mat2x4 axes, const glm::vec4 t, const glm::vec4 v)
+    {
+        double ret = 0.0;
+        for (int i = 0; i < 2; ++i)
+        {
+            const glm::dvec4 axis = glm::normalize(glm::dvec4(axes[i]));
+            ret = std::max({ret, std::abs(glm::dot(axis, glm::normalize(reference(t)))), std::abs(glm::dot(axis, glm::normalize(reference(v))))});
+        }
+        return ret;
+    }
+
+    glm::vec4 randomCoord(std::mt19937& rng)
+    {
+        std::normal_distribution<float> normal;
+        return glm::normalize(glm::vec4(normal(rng), normal(rng), normal(rng), normal(rng)));
+    }
+
+    std::vector<Input> randomInputs(const size_t num_inputs)
+    {
+        std::mt19937 rng(12345);
+        std::vector<Input> inputs;
+        for (size_t i = 0; i < num_inputs; ++i)
+        {
+            inputs.push_back({randomCoord(rng), randomCoord(rng), randomCoord(rng)});
+        }
+        return inputs;
+    }
+
+    std::vector<Input> axisAlignedInputs(const size_t num_inputs)
+    {
+        std::mt19937 rng(12345);
+        std::uniform_real_distribution<float> angle(-3.0f, 3.0f);
+        std::vector<Input> inputs;
+        for (size_t i = 0; i < num_inputs; ++i)
+        {
+            const float alpha = angle(rng);
+            inputs.push_back({
+                glm::hs::origin_hypersphere_orientation[3],
+                glm::vec4(0.0f, 0.0f, std::sin(alpha), std::cos(alpha)),
+                randomCoord(rng)
+            });
+        }
+        return inputs;
+    }
+
+    // minimum time per input over all repetitions in nanoseconds
+    template<typename F>
+    double time(const std::vector<Input>& inputs, const size_t repetitions, F f)
+    {
+        double best = std::numeric_limits<double>::infinity();
+        float sum = 0.0f;
+        for (size_t repetition = 0; repetition < repetitions; ++repetition)
+        {
+            const auto start = Clock::now();
+            for (const auto& input : inputs)
+            {
+                sum += f(input);
+            }
+            best = std::min(best, std::chrono::duration<double>(Clock::now() - start).count());
+        }
+        sink = sum;
+        return best * 1e9 / double(inputs.size());
+    }
+
+    struct Accuracy
+    {
+        double max_error = 0.0;
+        size_t num_not_finite = 0;
+    };
+
+    template<typename F>
+    Accuracy accuracy(const std::vector<Input>& inputs, F error)
+    {
+        Accuracy ret;
+        for (const auto& input : inputs)
+        {
+            const double e = error(input);
+            if (std::isfinite(e))
+            {
+                ret.max_error = std::max(ret.max_error, e);
+            }
+            else
+            {
+                ret.num_not_finite += 1;
+            }
+        }
+        return ret;
+    }
+
+    // f(input) computes the result of the function, error(result, input) its error or NaN if it's not finite
+    template<typename R, typename F, typename G, typename E>
+    json compare(
+        const std::string& function,
+        const std::vector<Input>& inputs,
+        const size_t repetitions,
+        F legacy_f,
+        G f,
+        E error
+    )
+    {
+        const auto sum = [](const R& result)
+        {
+            if constexpr (std::is_same_v<R, glm::vec4>)
+            {
+                return result.x + result.y + result.z + result.w;
+            }
+            else
+            {
+                return result[0].x + result[1].w;
+            }
+        };
+        const double legacy_ns = time(inputs, repetitions, [&](const Input& input) { return sum(legacy_f(input)); });
+        const double ns = time(inputs, repetitions, [&](const Input& input) { return sum(f(input)); });
+        const Accuracy legacy_accuracy = accuracy(inputs, [&](const Input& input) { return error(legacy_f(input), input); });
+        const Accuracy new_accuracy = accuracy(inputs, [&](const Input& input) { return error(f(input), input); });
+        return {
+            {"function", function},
+            {"legacy_ns_per_call", legacy_ns},
+            {"ns_per_call", ns},
+            {"speedup", legacy_ns / ns},
+            {"legacy_max_error", legacy_accuracy.max_error},
+            {"max_error", new_accuracy.max_error},
+            {"legacy_num_not_finite", legacy_accuracy.num_not_finite},
+            {"num_not_finite", new_accuracy.num_not_finite}
+        };
+    }
+
+    json compareAll(const std::vector<Input>& inputs, const size_t repetitions)
+    {
+        json results = json::array();
+        results.push_back(compare<glm::vec4>(
+            "cross3", inputs, repetitions,
+            [](const Input& input) { return legacy::cross3(input.a, input.b, input.c); },
+            [](const Input& input) { return glm::hs::cross3(input.a, input.b, input.c); },
+            [](const glm::vec4 result, const Input& input)
+            {
+                return isFinite(result) ? difference(
+                    result, referenceCross3(reference(input.a), reference(input.b), reference(input.c))
+                ) : std::numeric_limits<double>::quiet_NaN();
+            }
+        ));
+        // the bases of the previous version aren't normalized, so only the orthogonality can be compared
+        results.push_back(compare<glm::mat2x4>(
+            "orthogonalPlane", inputs, repetitions,
+            [](const Input& input) { return legacy::orthogonalPlane(input.a, input.b); },
+            [](const Input& input) { return glm::hs::orthogonalPlane(input.a, input.b); },
+            [](const glm::mat2x4 result, const Input& input)
+            {
+                return isFinite(result[0]) && isFinite(result[1]) ?
+                       orthogonality(result, input.a, input.b) : std::numeric_limits<double>::quiet_NaN();
+            }
+        ));
+        results.push_back(compare<glm::mat2x4>(
+            "plane", inputs, repetitions,
+            [](const Input& input) { return legacy::plane(input.a, input.b); },
+            [](const Input& input) { return glm::hs::plane(input.a, input.b); },
+            [](const glm::mat2x4 result, const Input& input)
+            {
+                const glm::dvec4 v = glm::normalize(reference(input.b));
+                const glm::dvec4 t = reference(input.a);
+                return isFinite(result[0]) && isFinite(result[1]) ? std::max(
+                    difference(result[0], v), difference(result[1], glm::normalize(t - glm::dot(t, v) * v))
+                ) : std::numeric_limits<double>::quiet_NaN();
+            }
+        ));
+        results.push_back(compare<glm::vec4>(
+            "getLocalDirectionalVector", inputs, repetitions,
+            [](const Input& input) { return legacy::getLocalDirectionalVector(input.a, input.b); },
+            [](const Input& input) { return glm::hs::getLocalDirectionalVector(input.a, input.b); },
+            [](const glm::vec4 result, const Input& input)
+            {
+                return isFinite(result) ? difference(
+                    result, referenceLocalDirectionalVector(reference(input.a), reference(input.b))
+                ) : std::numeric_limits<double>::quiet_NaN();
+            }
+        ));
+        return results;
+    }
+
+    json compareViewAngles(const size_t num_inputs, const size_t repetitions)
+    {
+        const float radius = 400.0f;
+        std::mt19937 rng(12345);
+        std::uniform_real_distribution<float> position(-2000.0f, 2000.0f);
+        std::uniform_real_distribution<float> angle(-3.0f, 3.0f);
+        struct ViewInput
+        {
+            glm::mat3 camera_orientation;
+            glm::mat4 camera_hypersphere_orientation;
+            glm::vec4 object_coord;
+            // computed once per frame by the renderer, so it's not part of the measurement
+            glm::mat4 camera_frame;
+        };
+        std::vector<ViewInput> inputs;
+        for (size_t i = 0; i < num_inputs; ++i)
+        {
+            const glm::vec3 axis = glm::normalize(glm::vec3(randomCoord(rng)) + glm::vec3(0.0f, 0.0f, 1e-3f));
+            const glm::mat3 camera_orientation = glm::mat3(glm::rotate(glm::mat4(1.0f), angle(rng), axis));
+            const glm::mat4 camera_hypersphere_orientation = glm::hs::orthonormalize(glm::hs::getHypersphereOrientation(
+                glm::hs::origin_hypersphere_orientation,
+                glm::hs::getHypersphereCoordinate(glm::vec3(position(rng), position(rng), position(rng)), radius)
+            ));
+            inputs.push_back({
+                camera_orientation,
+                camera_hypersphere_orientation,
+                randomCoord(rng),
+                glm::hs::getCameraFrame(camera_orientation, camera_hypersphere_orientation)
+            });
+        }
+
+        const auto timeViewAngles = [&](const auto f)
+        {
+            double best = std::numeric_limits<double>::infinity();
+            float sum = 0.0f;
+            for (size_t repetition = 0; repetition < repetitions; ++repetition)
+            {
+                const auto start = Clock::now();
+                for (const auto& input : inputs)
+                {
+                    const glm::vec3 view_angles = f(input.camera_frame, input.object_coord, radius);
+                    sum += view_angles.x + view_angles.y + view_angles.z;
+                }
+                best = std::min(best, std::chrono::duration<double>(Clock::now() - start).count());
+            }
+            sink = sum;
+            return best * 1e9 / double(inputs.size());
+        };
+        const double legacy_ns = timeViewAngles(
+            [](const glm::mat4 camera_frame, const glm::vec4 object_coord, const float r)
+            {
+                return glm::hs::getViewAngles(camera_frame, object_coord, r);
+            }
+        );
+        const double ns = timeViewAngles(
+            [](const glm::mat4 camera_frame, const glm::vec4 object_coord, const float r)
+            {
+                return glm::hs::getViewAnglesAtan2(camera_frame, object_coord, r);
+            }
+        );
+
+        Accuracy legacy_angle;
+        Accuracy angle_accuracy;
+        double max_angle_difference = 0.0;
+        double max_distance_difference = 0.0;
+        size_t num_not_finite = 0;
+        const auto angleError = [](const glm::vec3 view_angles, const glm::dvec3 expected)
+        {
+            return std::max(std::abs(double(view_angles.x) - expected.x), std::abs(double(view_angles.y) - expected.y));
+        };
+        for (const auto& input : inputs)
+        {
+            const glm::vec3 expected = glm::hs::getViewAngles(input.camera_frame, input.object_coord, radius);
+            const glm::vec3 view_angles = glm::hs::getViewAnglesAtan2(input.camera_frame, input.object_coord, radius);
+            if (!isFinite(glm::vec4(expected, 0.0f)) || !isFinite(glm::vec4(view_angles, 0.0f)))
+            {
+                num_not_finite += 1;
+                continue;
+            }
+            const glm::dvec3 reference_angles = referenceViewAngles(
+                input.camera_orientation, input.camera_hypersphere_orientation, input.object_coord, radius
+            );
+            legacy_angle.max_error = std::max(legacy_angle.max_error, angleError(expected, reference_angles));
+            angle_accuracy.max_error = std::max(angle_accuracy.max_error, angleError(view_angles, reference_angles));
+            max_angle_difference = std::max(max_angle_difference, angleError(view_angles, expected));
+            max_distance_difference = std::max(
+                max_distance_difference, std::abs(double(expected.z) - double(view_angles.z)) / radius
+            );
+        }
+
+        return {
+            {"function", "getViewAnglesAtan2"},
+            {"legacy_ns_per_call", legacy_ns},
+            {"ns_per_call", ns},
+            {"speedup", legacy_ns / ns},
+            {"legacy_max_angle_error", legacy_angle.max_error},
+            {"max_angle_error", angle_accuracy.max_error},
+            {"max_angle_difference", max_angle_difference},
+            {"max_distance_difference", max_distance_difference},
+            {"num_not_finite", num_not_finite}
+        };
+    }
+
+    json compareCoords(const size_t num_inputs, const size_t repetitions)
+    {
+        const float radius = 400.0f;
+        std::mt19937 rng(12345);
+        std::uniform_real_distribution<float> position(-2000.0f, 2000.0f);
+        std::uniform_real_distribution<float> vertex(-50.0f, 50.0f);
+        std::uniform_real_distribution<float> angle(-3.0f, 3.0f);
+        struct CoordInput
+        {
+            glm::mat3 orientation;
+            glm::mat4 hypersphere_orientation;
+            glm::vec3 offset;
+            // computed once per object by the renderer, so it's not part of the measurement
+            glm::mat4 model_frame;
+        };
+        std::vector<CoordInput> inputs;
+        for (size_t i = 0; i < num_inputs; ++i)
+        {
+            const glm::vec3 axis = glm::normalize(glm::vec3(randomCoord(rng)) + glm::vec3(0.0f, 0.0f, 1e-3f));
+            const glm::mat3 orientation = glm::mat3(glm::rotate(glm::mat4(1.0f), angle(rng), axis));
+            const glm::mat4 hypersphere_orientation = glm::hs::orthonormalize(glm::hs::getHypersphereOrientation(
+                glm::hs::origin_hypersphere_orientation,
+                glm::hs::getHypersphereCoordinate(glm::vec3(position(rng), position(rng), position(rng)), radius)
+            ));
+            // some vertices lie at the origin of their model
+            const glm::vec3 offset = i % 16 == 0 ? glm::vec3(0.0f) : glm::vec3(vertex(rng), vertex(rng), vertex(rng));
+            inputs.push_back({
+                orientation, hypersphere_orientation, offset, glm::hs::getModelFrame(hypersphere_orientation, orientation)
+            });
+        }
+
+        const auto timeCoords = [&](const auto f)
+        {
+            double best = std::numeric_limits<double>::infinity();
+            float sum = 0.0f;
+            for (size_t repetition = 0; repetition < repetitions; ++repetition)
+            {
+                const auto start = Clock::now();
+                for (const auto& input : inputs)
+                {
+                    const glm::vec4 coord = f(input);
+                    sum += coord.x + coord.y + coord.z + coord.w;
+                }
+                best = std::min(best, std::chrono::duration<double>(Clock::now() - start).count());
+            }
+            sink = sum;
+            return best * 1e9 / double(inputs.size());
+        };
+        const auto legacy_f = [&](const CoordInput& input)
+        {
+            return glm::hs::getCoord(input.hypersphere_orientation, input.orientation, input.offset, radius);
+        };
+        const auto f = [&](const CoordInput& input)
+        {
+            return glm::hs::getCoord(input.model_frame, input.offset, radius);
+        };
+        const double legacy_ns = timeCoords(legacy_f);
+        const double ns = timeCoords(f);
+
+        Accuracy legacy_accuracy;
+        Accuracy new_accuracy;
+        const auto addError = [](Accuracy& accuracy, const glm::vec4 coord, const glm::dvec4 expected)
+        {
+            if (isFinite(coord))
+            {
+                accuracy.max_error = std::max(accuracy.max_error, difference(coord, expected));
+            }
+            else
+            {
+                accuracy.num_not_finite += 1;
+            }
+        };
+        for (const auto& input : inputs)
+        {
+            const glm::dvec4 expected = referenceCoord(
+                input.hypersphere_orientation, input.orientation, input.offset, radius
+            );
+            addError(legacy_accuracy, legacy_f(input), expected);
+            addError(new_accuracy, f(input), expected);
+        }
+
+        return {
+            {"function", "getCoord"},
+            {"legacy_ns_per_call", legacy_ns},
+            {"ns_per_call", ns},
+            {"speedup", legacy_ns / ns},
+            {"legacy_max_error", legacy_accuracy.max_error},
+            {"max_error", new_accuracy.max_error},
+            {"legacy_num_not_finite", legacy_accuracy.num_not_finite},
+            {"num_not_finite", new_accuracy.num_not_finite}
+        };
+    }
+
+    // f and exact are float -> float, reference is double -> double
+    template<typename F, typename E, typename R>
+    json compareApproximation(
+        const std::string& function,
+        const float low,
+        const float high,
+        const size_t num_inputs,
+        const size_t repetitions,
+        F f,
+        E exact,
+        R reference
+    )
+    {
+        std::vector<float> inputs;
+        for (size_t i = 0; i < num_inputs; ++i)
+        {
+            inputs.push_back(low + (high - low) * float(i) / float(std::max<size_t>(num_inputs - 1, 1)));
+        }
+
+        // results are written to an array like in batch math, a sum would keep the loop from being vectorized
+        std::vector<float> outputs(inputs.size());
+        const auto timeFunction = [&](const auto g)
+        {
+            double best = std::numeric_limits<double>::infinity();
+            for (size_t repetition = 0; repetition < repetitions; ++repetition)
+            {
+                const auto start = Clock::now();
+                for (size_t i = 0; i < inputs.size(); ++i)
+                {
+                    outputs[i] = g(inputs[i]);
+                }
+                best = std::min(best, std::chrono::duration<double>(Clock::now() - start).count());
+                sink = outputs[repetition % outputs.size()];
+            }
+            return best * 1e9 / double(inputs.size());
+        };
+        const double exact_ns = timeFunction(exact);
+        const double ns = timeFunction(f);
+
+        double max_error = 0.0;
+        double max_ulp_error = 0.0;
+        for (const float x : inputs)
+        {
+            const double expected = reference(double(x));
+            const float rounded = float(expected);
+            const double ulp = double(std::nextafter(std::abs(rounded), std::numeric_limits<float>::infinity())) -
+                               double(std::abs(rounded));
+            const double error = std::abs(double(f(x)) - expected);
+            max_error = std::max(max_error, error);
+            max_ulp_error = std::max(max_ulp_error, std::abs(double(f(x)) - double(rounded)) / ulp);
+        }
+
+        return {
+            {"function", function},
+            {"low", low},
+            {"high", high},
+            {"exact_ns_per_call", exact_ns},
+            {"ns_per_call", ns},
+            {"speedup", exact_ns / ns},
+            {"max_error", max_error},
+            {"max_ulp_error", max_ulp_error}
+        };
+    }
+
+    json compareApproximations(const size_t num_inputs, const size_t repetitions)
+    {
+        json results = json::array();
+        results.push_back(compareApproximation(
+            "approx_acos", -1.0f, 1.0f, num_inputs, repetitions,
+            [](const float x) { return glm::hs::approx_acos(x); },
+            [](const float x) { return std::acos(x); },
+            [](const double x) { return std::acos(x); }
+        ));
+        for (const float range : {glm::two_pi<float>(), 1000.0f})
+        {
+            results.push_back(compareApproximation(
+                "approx_sin", -range, range, num_inputs, repetitions,
+                [](const float x) { return glm::hs::approx_sin(x); },
+                [](const float x) { return std::sin(x); },
+                [](const double x) { return std::sin(x); }
+            ));
+            results.push_back(compareApproximation(
+                "approx_cos", -range, range, num_inputs, repetitions,
+                [](const float x) { return glm::hs::approx_cos(x); },
+                [](const float x) { return std::cos(x); },
+                [](const double x) { return std::cos(x); }
+            ));
+        }
+        return results;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const size_t num_inputs = argc > 1 ? std::stoul(argv[1]) : 100'000;
+    const size_t repetitions = argc > 2 ? std::max<size_t>(std::stoul(argv[2]), 1) : 5;
+
+    const json results = {
+        {"benchmark", "hs_math"},
+        {"num_inputs", num_inputs},
+        {"random", compareAll(randomInputs(num_inputs), repetitions)},
+        {"axis_aligned", compareAll(axisAlignedInputs(num_inputs), repetitions)},
+        {"view_angles", compareViewAngles(num_inputs, repetitions)},
+        {"coords", compareCoords(num_inputs, repetitions)},
+        {"approximations", compareApproximations(num_inputs, repetitions)}
+    };
+    std::cout << results.dump(4) << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include "motion_batch.hpp"
+#include "shared_glm_glsl.h"
+#include "json.hpp"
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+ * Compares motion_batch::integrate() with the scalar glm::hs::getHypersphereOrientation() path of
+ * World::motionSystem(). Prints one JSON object with the results to stdout.
+ *
+ *     glome_bench_motion [num_bodies] [num_steps]
+ *
+ * Timings are per step. The deviation is the largest difference of a matrix entry between both paths after
+ * num_steps steps.
+ */
+
+using json = nlohmann::json;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    double secondsSince(const Clock::time_point start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const size_t num_bodies = argc > 1 ? std::stoul(argv[1]) : 1'000'000;
+    const size_t num_steps = argc > 2 ? std::max<size_t>(std::stoul(argv[2]), 1) : 60;
+    const Metre<float> radius = 400.0f * metre;
+    const Second<float> delta = (1.0f / 60.0f) * second;
+
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> speed(-50.0f, 50.0f);
+    std::vector<HypersphereOrientation> orientations;
+    std::vector<Velocity3D> velocities;
+    orientations.reserve(num_bodies);
+    velocities.reserve(num_bodies);
+    for (size_t i = 0; i < num_bodies; ++i)
+    {
+        orientations.emplace_back(glm::hs::getHypersphereOrientation(
+            glm::hs::origin_hypersphere_orientation,
+            glm::hs::getHypersphereCoordinate(glm::vec3(position(rng), position(rng), position(rng)), radius)
+        ));
+        // some bodies are at rest
+        velocities.emplace_back(i % 8 == 0 ? glm::vec3(0.0f) : glm::vec3(speed(rng), speed(rng), speed(rng)));
+    }
+
+    std::vector<HypersphereOrientation> scalar = orientations;
+    auto start = Clock::now();
+    for (size_t step = 0; step < num_steps; ++step)
+    {
+        for (size_t i = 0; i < num_bodies; ++i)
+        {
+            if (glm::length(velocities[i].value) > 0.0)
+            {
+                scalar[i] = HypersphereOrientation{glm::hs::getHypersphereOrientation(
+                    scalar[i], glm::mat3(1.0), (velocities[i] * delta).value, radius
+                )};
+            }
+        }
+    }
+    const double scalar_seconds = secondsSince(start) / double(num_steps);
+
+    std::vector<HypersphereOrientation> batch = orientations;
+    start = Clock::now();
+    for (size_t step = 0; step < num_steps; ++step)
+    {
+        motion_batch::integrate(batch, velocities, delta, radius);
+    }
+    const double batch_seconds = secondsSince(start) / double(num_steps);
+
+    float max_deviation = 0.0f;
+    for (size_t i = 0; i < num_bodies; ++i)
+    {
+        const glm::mat4 a = scalar[i];
+        const glm::mat4 b = batch[i];
+        for (int column = 0; column < 4; ++column)
+        {
+            for (int row = 0; row < 4; ++row)
+            {
+                max_deviation = std::max(max_deviation, std::abs(a[column][row] - b[column][row]));
+            }
+        }
+    }
+
+    const json results = {
+        {"benchmark", "motion"},
+        {"num_bodies", num_bodies},
+        {"num_steps", num_steps},
+        {"scalar_ms_per_step", scalar_seconds * 1e3},
+        {"batch_ms_per_step", batch_seconds * 1e3},
+        {"speedup", scalar_seconds / batch_seconds},
+        {"max_deviation", max_deviation}
+    };
+    std::cout << results.dump(4) << std::endl;
+
+    return 0;
+}
@@ -2,6 +2,8 @@
 
 out vec4 out_color;
 
+#insert FAST_HS_MATH
+
 #include_glsl "src/shared_glm_glsl.h"
 
 #insert MAX_NUM_LIGHTS
@@ -1,7 +1,11 @@
 #version
 
+#insert FAST_HS_MATH
+
 #include_glsl "src/shared_glm_glsl.h"
 
+#insert ATAN2_VIEW_ANGLES
+
 layout(location = 0) in vec3 vert_position_model_space;
 layout(location = 1) in vec3 vert_normal_model_space;
 layout(location = 2) in vec3 vert_tangent_model_space;
@@ -14,10 +18,10 @@ out VsOut
     mat4 tangent_to_world_space;
 } vs_out;
 
-uniform mat4 model_hypersphere_orientation;
-uniform mat3 model_orientation;
-uniform mat4 camera_hypersphere_orientation;
-uniform mat3 camera_orientation;
+// glm::hs::getModelFrame(), computed once per object
+uniform mat4 model_frame;
+// glm::hs::getCameraFrame(), computed once per frame
+uniform mat4 camera_frame;
 uniform float field_of_view;
 uniform float aspect_ratio;
 uniform float far_plane;
@@ -27,11 +31,15 @@ void main()
 {
     enablePrintf();
 
-    vec4 vert_coord = getCoord(model_hypersphere_orientation, model_orientation, vert_position_model_space, radius);
+    vec4 vert_coord = getCoord(model_frame, vert_position_model_space, radius);
 
     vs_out.coord = vert_coord;
 
-    vec3 view_angles = getViewAngles(camera_orientation, camera_hypersphere_orientation, vert_coord, radius);
+#if ATAN2_VIEW_ANGLES
+    vec3 view_angles = getViewAnglesAtan2(camera_frame, vert_coord, radius);
+#else
+    vec3 view_angles = getViewAngles(camera_frame, vert_coord, radius);
+#endif
     gl_Position = vec4(getViewSpaceCoords(
         view_angles,
         field_of_view, aspect_ratio, far_plane
@@ -49,18 +57,15 @@ void main()
         gl_Position.x = gl_Position.x/0.0;
     }
 
-    vec4 vert_normal_world_space =
-        model_hypersphere_orientation*vec4(model_orientation*vert_normal_model_space, 0);
-    vec4 vert_tangent_world_space =
-        model_hypersphere_orientation*vec4(model_orientation*vert_tangent_model_space, 0.0);
-    vec4 vert_bi_tangent_world_space =
-        model_hypersphere_orientation*vec4(model_orientation*cross(vert_tangent_model_space, vert_normal_model_space), 0.0);
+    vec4 vert_normal_world_space = model_frame*vec4(vert_normal_model_space, 0);
+    vec4 vert_tangent_world_space = model_frame*vec4(vert_tangent_model_space, 0.0);
+    vec4 vert_bi_tangent_world_space = model_frame*vec4(cross(vert_tangent_model_space, vert_normal_model_space), 0.0);
 
     vs_out.tangent_to_world_space = mat4(
         normalize(vert_tangent_world_space),
         normalize(vert_normal_world_space),
         normalize(vert_bi_tangent_world_space),
-        normalize(model_hypersphere_orientation[3])
+        normalize(model_frame[3])
     );
 
     vs_out.texture_coordinate = texture_coordinate;
@@ -13,7 +13,7 @@ Renderer::Renderer(
             {"./shader/hyper.vert", GL_VERTEX_SHADER},
             {"./shader/hyper.frag", GL_FRAGMENT_SHADER}
         },
-        {{"MAX_NUM_LIGHTS", m_max_num_lights}}
+        {{"MAX_NUM_LIGHTS", m_max_num_lights}, {"ATAN2_VIEW_ANGLES", atan2ViewAngles}, {"FAST_HS_MATH", FAST_HS_MATH}}
     );
 
     m_depth_buffer = gl::Renderbuffer(GL_DEPTH_COMPONENT32F, m_width, m_height);
@@ -42,8 +42,7 @@ void Renderer::render()
         GL_TRIANGLES,
         m_program,
         std::make_tuple(
-            std::tuple("camera_hypersphere_orientation", m_camera.hypersphere_orientation),
-            std::tuple("camera_orientation", m_camera.orientation),
+            std::tuple("camera_frame", glm::hs::getCameraFrame(m_camera.orientation, m_camera.hypersphere_orientation)),
             std::tuple("field_of_view", m_camera.field_of_view),
             std::tuple("aspect_ratio", m_aspect_ratio),
             std::tuple("far_plane", m_camera.far_plane),
@@ -54,13 +53,11 @@ void Renderer::render()
             std::tuple("num_lights", (int) m_light_colors.size())
         ),
         std::make_tuple(
-            std::tuple("model_hypersphere_orientation", &MeshData::hypersphere_orientation),
-            std::tuple("model_orientation", &MeshData::model_orientation),
+            std::tuple("model_frame", &MeshData::model_frame),
             std::tuple("diffuse_texture", &MeshData::texture),
             std::tuple("normal_map", &MeshData::normal_map)
         )
     );
-    m_mesh_vector.clear();
     m_light_colors.clear();
     m_light_coords.clear();
 }
\ No newline at end of file
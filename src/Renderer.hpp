@@ -2,6 +2,7 @@
 
 #include "gl.hpp"
 #include "types.hpp"
+#include "shared_glm_glsl.h"
 
 class Renderer
 {
@@ -42,11 +43,54 @@ public:
         gl::VertexArray vao;
         HypersphereOrientation hypersphere_orientation;
         Orientation3D model_orientation;
+        // glm::hs::getModelFrame() of the two above, set by submitMesh() and updateMesh()
+        glm::mat4 model_frame = glm::mat4(1.0f);
     };
 
-    void submitMesh(const MeshData& mesh)
+    // Submitted meshes are drawn every frame until they are removed, so static meshes only have to be submitted
+    // once. Returns the id that updateMesh() and removeMesh() expect.
+    size_t submitMesh(const MeshData& mesh)
     {
+        size_t mesh_id = m_mesh_indices.size();
+        if (!m_unused_mesh_ids.empty())
+        {
+            mesh_id = m_unused_mesh_ids.back();
+            m_unused_mesh_ids.pop_back();
+        }
+        else
+        {
+            m_mesh_indices.push_back(0);
+        }
+        m_mesh_indices[mesh_id] = m_mesh_vector.size();
+        m_mesh_vector_ids.push_back(mesh_id);
         m_mesh_vector.push_back(mesh);
+        m_mesh_vector.back().model_frame = glm::hs::getModelFrame(mesh.hypersphere_orientation, mesh.model_orientation);
+        return mesh_id;
+    }
+
+    // the id may be returned by a later call of submitMesh()
+    void removeMesh(const size_t mesh_id)
+    {
+        // the last mesh is moved into the gap, so that m_mesh_vector only contains meshes that are drawn
+        const size_t index = m_mesh_indices[mesh_id];
+        m_mesh_vector[index] = std::move(m_mesh_vector.back());
+        m_mesh_vector_ids[index] = m_mesh_vector_ids.back();
+        m_mesh_indices[m_mesh_vector_ids[index]] = index;
+        m_mesh_vector.pop_back();
+        m_mesh_vector_ids.pop_back();
+        m_unused_mesh_ids.push_back(mesh_id);
+    }
+
+    void updateMesh(
+        const size_t mesh_id,
+        const HypersphereOrientation& hypersphere_orientation,
+        const Orientation3D& model_orientation
+    )
+    {
+        MeshData& mesh = m_mesh_vector[m_mesh_indices[mesh_id]];
+        mesh.hypersphere_orientation = hypersphere_orientation;
+        mesh.model_orientation = model_orientation;
+        mesh.model_frame = glm::hs::getModelFrame(hypersphere_orientation, model_orientation);
     }
 
     void submitLight(const glm::vec4& coord, const Light& light)
@@ -67,7 +111,13 @@ private:
     glm::vec4 m_fog_color = glm::vec4{0.0, 0.0, 0.0, 0.0};
 
     std::vector<MeshData> m_mesh_vector;
+    // mesh id of every entry of m_mesh_vector and index into m_mesh_vector of every mesh id
+    std::vector<size_t> m_mesh_vector_ids;
+    std::vector<size_t> m_mesh_indices;
+    std::vector<size_t> m_unused_mesh_ids;
     const int m_max_num_lights;
+    // selects glm::hs::getViewAnglesAtan2() instead of glm::hs::getViewAngles() in the vertex shader
+    static constexpr int atan2ViewAngles = 1;
     std::vector<glm::vec4> m_light_coords;
     std::vector<glm::vec3> m_light_colors;
 
@@ -2,6 +2,7 @@
 
 #include "../meta/logo.hpp"
 #include "shared_glm_glsl.h"
+#include "motion_batch.hpp"
 #include <glm/gtx/transform.hpp>
 
 //TODO: class 3: move the json-to-ec_system functions to a own cpp file
@@ -45,18 +46,26 @@ namespace glm
     }
 }
 
+namespace
+{
+    Orientation3D getOrientation3DFromJson(const json& object)
+    {
+        return Orientation3D{glm::rotate(
+            glm::mat4(1.0),
+            glm::radians(object.at("angle").get<float>()),
+            object.at("axis").get<glm::vec3>()
+        )};
+    }
+}
+
 void World::addComponentFromJsonOrientation3D(const json& object, const ec_system::Entity& entity)
 {
-    m_entity_manager.createComponent<Orientation3D>(entity, Orientation3D{glm::rotate(
-        glm::mat4(1.0),
-        glm::radians(object.at("angle").get<float>()),
-        object.at("axis").get<glm::vec3>()
-    )});
+    m_scheduler.getCommandBuffer().createComponent<Orientation3D>(entity, getOrientation3DFromJson(object));
 }
 
 void World::addComponentFromJsonAngularVelocity3D(const json& object, const ec_system::Entity& entity)
 {
-    m_entity_manager.createComponent<AngularVelocity3D>(entity, AngularVelocity3D{
+    m_scheduler.getCommandBuffer().createComponent<AngularVelocity3D>(entity, AngularVelocity3D{
         glm::radians(object.at("value").get<float>()) * glm::normalize(object.at("axis").get<glm::vec3>()) * radian / second
     });
 }
@@ -64,7 +73,7 @@ void World::addComponentFromJsonAngularVelocity3D(const json& object, const ec_s
 void World::addComponentFromJsonHypersphereOrientation(const json& object, const ec_system::Entity& entity)
 {
     const Position3D position = Position3D{object.get<glm::vec3>()};
-    m_entity_manager.createComponent<HypersphereOrientation>(entity, HypersphereOrientation{
+    m_scheduler.getCommandBuffer().createComponent<HypersphereOrientation>(entity, HypersphereOrientation{
         glm::hs::getHypersphereOrientation(
             glm::hs::origin_hypersphere_orientation,
             glm::hs::getHypersphereCoordinate(position, m_radius)
@@ -74,24 +83,25 @@ void World::addComponentFromJsonHypersphereOrientation(const json& object, const
 
 void World::addComponentFromJsonVelocity3D(const json& object, const ec_system::Entity& entity)
 {
-    m_entity_manager.createComponent<Velocity3D>(entity, Velocity3D{object.get<glm::vec3>()});
+    m_scheduler.getCommandBuffer().createComponent<Velocity3D>(entity, Velocity3D{object.get<glm::vec3>()});
 }
 
 void World::addComponentFromJsonMeshVector(const json& object, const ec_system::Entity& entity)
 {
-    m_entity_manager.createComponent<std::vector<Mesh>>(entity, getMeshesFromObj(
-        object.get<std::filesystem::path>()
-    ));
+    m_scheduler.getCommandBuffer().createComponent<MeshFile>(entity, object.get<std::filesystem::path>());
+    m_scheduler.getCommandBuffer().createComponent<ec_system::Shared<std::vector<Mesh>>>(
+        entity, loadMeshes(object.get<std::filesystem::path>())
+    );
 }
 
 void World::addComponentFromJsonName(const json& object, const ec_system::Entity& entity)
 {
-    m_entity_manager.createComponent<Name>(entity, object.get<std::string>());
+    m_scheduler.getCommandBuffer().createComponent<Name>(entity, object.get<std::string>());
 }
 
 void World::addComponentFromJsonLight(const json& object, const ec_system::Entity& entity)
 {
-    m_entity_manager.createComponent<Light>(entity, Light{
+    m_scheduler.getCommandBuffer().createComponent<Light>(entity, Light{
         object.at("intensity").get<float>(),
         object.at("color").get<glm::vec3>()
     });
@@ -99,7 +109,7 @@ void World::addComponentFromJsonLight(const json& object, const ec_system::Entit
 
 void World::addComponentFromJsonCamera(const json& object, const ec_system::Entity& entity)
 {
-    m_entity_manager.createComponent<World::Camera>(entity, World::Camera{
+    m_scheduler.getCommandBuffer().createComponent<World::Camera>(entity, World::Camera{
         glm::radians(object.at("field_of_view").get<float>()) * radian
     });
 }
@@ -132,145 +142,495 @@ void World::init()
     m_renderer->setHypersphereRadius(m_radius);
     m_renderer->setFogColor(m_fog_color);
 
-    for (const json& object : world_json["objects"])
+    if (world_json.contains("snapshot"))
     {
-        auto entity = m_entity_manager.createEntity();
-        for (const auto& tmp : object.items())
+        m_snapshot_file = world_json["snapshot"].get<std::filesystem::path>();
+    }
+
+    if (!m_snapshot_file.empty() && std::filesystem::exists(m_snapshot_file))
+    {
+        restoreSnapshot(m_snapshot_file);
+    }
+    else
+    {
+        for (const json& object : world_json["objects"])
         {
-            if (m_json_component_mapping.count(tmp.key()) != 0)
-            {
-                m_json_component_mapping.at(tmp.key())(tmp.value(), entity);
-            }
+            loadObject(object);
         }
+        m_scheduler.getCommandBuffer().apply(m_entity_manager);
     }
+
+    initSystems();
 }
 
-void World::loop()
+void World::loadObject(const json& object, const std::optional<ec_system::Entity> parent)
 {
-    std::chrono::microseconds rendering_time;
-    while (!m_window->shouldClose())
+    // children store the handle of their parent, so a placeholder of the command buffer can't be used
+    const auto entity = m_entity_manager.reserveEntity();
+    auto& command_buffer = m_scheduler.getCommandBuffer();
+    if (parent)
     {
-        static auto last = std::chrono::high_resolution_clock::now();
-        auto now = std::chrono::high_resolution_clock::now();
-        Second<float> delta = std::chrono::duration_cast<std::chrono::milliseconds>(now - last).count() * milli * second;
-        last = now;
+        command_buffer.createComponent<Parent>(entity, Parent{
+            *parent,
+            Position3D{object.value("offset", glm::vec3(0.0)) * metre},
+            object.contains("orientation") ? getOrientation3DFromJson(object["orientation"]) : Orientation3D{glm::mat3(1.0f)}
+        });
+        // computed by transformSystem()
+        command_buffer.createComponent<HypersphereOrientation>(entity, glm::hs::origin_hypersphere_orientation);
+        command_buffer.createComponent<Orientation3D>(entity, glm::mat3(1.0f));
+    }
+    for (const auto& tmp : object.items())
+    {
+        if (m_json_component_mapping.count(tmp.key()) != 0 && !(parent && (tmp.key() == "position" || tmp.key() == "orientation")))
+        {
+            m_json_component_mapping.at(tmp.key())(tmp.value(), entity);
+        }
+    }
+    for (const json& child : object.value("children", json::array()))
+    {
+        loadObject(child, entity);
+    }
+}
+
+void World::saveSnapshot(const std::filesystem::path& file_path) const
+{
+    ec_system::Snapshot::save<
+        Orientation3D, AngularVelocity3D, HypersphereOrientation, Velocity3D, Name, Light, World::Camera, MeshFile,
+        World::Parent
+    >(m_entity_manager, file_path);
+}
+
+void World::restoreSnapshot(const std::filesystem::path& file_path)
+{
+    ec_system::Snapshot::restore<
+        Orientation3D, AngularVelocity3D, HypersphereOrientation, Velocity3D, Name, Light, World::Camera, MeshFile,
+        World::Parent
+    >(m_entity_manager, file_path);
+
+    // GPU resources can't be part of a snapshot
+    for (const auto entity : m_entity_manager.query<MeshFile>())
+    {
+        m_scheduler.getCommandBuffer().createComponent<ec_system::Shared<std::vector<Mesh>>>(
+            entity, loadMeshes(m_entity_manager.getUnchecked<MeshFile>(entity))
+        );
+    }
+    m_scheduler.getCommandBuffer().apply(m_entity_manager);
+}
 
-        //TODO: class 3: move all these loops to separate functions
-        for (const auto e : m_entity_manager.iterator<World::Camera, Orientation3D, Velocity3D, AngularVelocity3D>())
+ec_system::Shared<std::vector<Mesh>> World::loadMeshes(const std::filesystem::path& file_path)
+{
+    return m_entity_manager.share<std::vector<Mesh>>(
+        file_path.string(), [&]
         {
-            //TODO: class 2: design proper input system (using event_system?)
-            auto& velocity = m_entity_manager.get<Velocity3D>(e);
-            velocity = Velocity3D{0.0, 0.0, 0.0};
-            constexpr auto max_camera_velocity = 30.0f * metre / second;
+            return getMeshesFromObj(file_path);
+        }
+    );
+}
 
-            if (m_window->isKeyPressed(GLFW_KEY_LEFT))
-            {
-                velocity += glm::normalize(m_entity_manager.get<Orientation3D>(e)[0]) * max_camera_velocity;
-            }
-            if (m_window->isKeyPressed(GLFW_KEY_RIGHT))
+void World::cameraInputSystem()
+{
+    for (auto [camera, orientation, velocity, angular_velocity] :
+        m_entity_manager.view<World::Camera, Orientation3D, Velocity3D, AngularVelocity3D>())
+    {
+        //TODO: class 2: design proper input system (using event_system?)
+        velocity = Velocity3D{0.0, 0.0, 0.0};
+        constexpr auto max_camera_velocity = 30.0f * metre / second;
+
+        if (m_window->isKeyPressed(GLFW_KEY_LEFT))
+        {
+            velocity += glm::normalize(orientation[0]) * max_camera_velocity;
+        }
+        if (m_window->isKeyPressed(GLFW_KEY_RIGHT))
+        {
+            velocity += glm::normalize(orientation[0]) * -max_camera_velocity;
+        }
+        if (m_window->isKeyPressed(GLFW_KEY_PAGE_UP))
+        {
+            velocity += glm::normalize(orientation[1]) * max_camera_velocity;
+        }
+        if (m_window->isKeyPressed(GLFW_KEY_PAGE_DOWN))
+        {
+            velocity += glm::normalize(orientation[1]) * -max_camera_velocity;
+        }
+        if (m_window->isKeyPressed(GLFW_KEY_UP))
+        {
+            velocity += glm::normalize(orientation[2]) * max_camera_velocity;
+        }
+        if (m_window->isKeyPressed(GLFW_KEY_DOWN))
+        {
+            velocity += glm::normalize(orientation[2]) * -max_camera_velocity;
+        }
+
+        angular_velocity = AngularVelocity3D{0.0, 0.0, 0.0};
+        constexpr auto max_camera_angular_velocity = glm::radians(120.0f) * radian / second;
+
+        if (m_window->isKeyPressed(GLFW_KEY_W))
+        {
+            angular_velocity += glm::normalize(orientation[0]) * max_camera_angular_velocity;
+        }
+        if (m_window->isKeyPressed(GLFW_KEY_S))
+        {
+            angular_velocity += glm::normalize(orientation[0]) * -max_camera_angular_velocity;
+        }
+        if (m_window->isKeyPressed(GLFW_KEY_A))
+        {
+            angular_velocity += glm::normalize(orientation[1]) * max_camera_angular_velocity;
+        }
+        if (m_window->isKeyPressed(GLFW_KEY_D))
+        {
+            angular_velocity += glm::normalize(orientation[1]) * -max_camera_angular_velocity;
+        }
+        if (m_window->isKeyPressed(GLFW_KEY_E))
+        {
+            angular_velocity += glm::normalize(orientation[2]) * max_camera_angular_velocity;
+        }
+        if (m_window->isKeyPressed(GLFW_KEY_Q))
+        {
+            angular_velocity += glm::normalize(orientation[2]) * -max_camera_angular_velocity;
+        }
+
+    }
+}
+
+void World::motionSystem()
+{
+    m_entity_manager.query<HypersphereOrientation, Velocity3D>().each().parallelRunBatches(
+        [&](
+            const std::span<const ec_system::Entity> entities,
+            const std::span<HypersphereOrientation> hypersphere_orientations,
+            const std::span<const Velocity3D> velocities
+        )
+        {
+            motion_batch::integrate(hypersphere_orientations, velocities, m_delta, m_radius);
+            for (size_t i = 0; i < entities.size(); ++i)
             {
-                velocity += glm::normalize(m_entity_manager.get<Orientation3D>(e)[0]) * -max_camera_velocity;
+                if (glm::length(velocities[i].value) > 0.0)
+                {
+                    m_entity_manager.markChanged<HypersphereOrientation>(entities[i]);
+                }
             }
-            if (m_window->isKeyPressed(GLFW_KEY_PAGE_UP))
+        });
+}
+
+void World::rotationSystem()
+{
+    m_entity_manager.query<Orientation3D, AngularVelocity3D>().each().parallelRun(
+        [&](const ec_system::Entity entity, Orientation3D& orientation, const AngularVelocity3D& angular_velocity)
+        {
+            const Radian<float> delta_value = glm::length(angular_velocity.value) * radian / second * m_delta;
+            if (delta_value > 0.0f)
             {
-                velocity += glm::normalize(m_entity_manager.get<Orientation3D>(e)[1]) * max_camera_velocity;
+                const auto axis = glm::normalize(angular_velocity.value);
+
+                orientation = Orientation3D{glm::rotate(
+                    glm::mat4(1.0),
+                    delta_value.value,
+                    axis
+                )} * orientation;
+                m_entity_manager.markChanged<Orientation3D>(entity);
             }
-            if (m_window->isKeyPressed(GLFW_KEY_PAGE_DOWN))
+        });
+}
+
+void World::transformSystem()
+{
+    const uint32_t since = m_transform_tick;
+    m_transform_tick = m_entity_manager.getChangeTick();
+
+    // the depth of an entity only changes if it gets a new parent
+    bool hierarchy_changed = false;
+    m_entity_manager.query<Parent>().each().changedSince<Parent>(since).run(
+        [&](const Parent&)
+        {
+            hierarchy_changed = true;
+        });
+    if (hierarchy_changed)
+    {
+        m_transform_batches.clear();
+        std::vector<ec_system::Entity> children;
+        for (const auto entity : m_entity_manager.query<Parent>())
+        {
+            children.push_back(entity);
+        }
+        for (const auto entity : children)
+        {
+            size_t depth = 0;
+            for (
+                auto ancestor = m_entity_manager.getUnchecked<Parent>(entity).entity;
+                m_entity_manager.has<Parent>(ancestor);
+                ancestor = m_entity_manager.getUnchecked<Parent>(ancestor).entity
+                )
             {
-                velocity += glm::normalize(m_entity_manager.get<Orientation3D>(e)[1]) * -max_camera_velocity;
+                depth += 1;
+                if (depth >= children.size())
+                {
+                    throw std::runtime_error(
+                        std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                        "Entity hierarchy contains a cycle.");
+                }
             }
-            if (m_window->isKeyPressed(GLFW_KEY_UP))
+            if (m_transform_batches.size() <= depth)
             {
-                velocity += glm::normalize(m_entity_manager.get<Orientation3D>(e)[2]) * max_camera_velocity;
+                m_transform_batches.resize(depth + 1);
             }
-            if (m_window->isKeyPressed(GLFW_KEY_DOWN))
+            m_transform_batches[depth].push_back(entity);
+        }
+    }
+
+    for (const auto& batch : m_transform_batches)
+    {
+        // entities of one batch only read transforms of the previous batches
+        m_entity_manager.parallelFor(batch.size(), 64, [&](const size_t begin, const size_t end)
+        {
+            for (size_t i = begin; i < end; ++i)
             {
-                velocity += glm::normalize(m_entity_manager.get<Orientation3D>(e)[2]) * -max_camera_velocity;
+                const auto entity = batch[i];
+                if (!m_entity_manager.has<Parent, HypersphereOrientation, Orientation3D>(entity))
+                {
+                    continue;
+                }
+                const Parent& parent = m_entity_manager.getUnchecked<Parent>(entity);
+                if (
+                    !m_entity_manager.has<HypersphereOrientation, Orientation3D>(parent.entity) || (
+                        !m_entity_manager.changed<Parent>(entity, since) &&
+                        !m_entity_manager.changed<HypersphereOrientation>(parent.entity, since) &&
+                        !m_entity_manager.changed<Orientation3D>(parent.entity, since)
+                    ))
+                {
+                    continue;
+                }
+                const auto& parent_orientation = m_entity_manager.getUnchecked<Orientation3D>(parent.entity);
+                m_entity_manager.getUnchecked<HypersphereOrientation>(entity) = HypersphereOrientation{
+                    glm::hs::getHypersphereOrientation(
+                        m_entity_manager.getUnchecked<HypersphereOrientation>(parent.entity),
+                        parent_orientation, parent.offset.value, m_radius
+                    )
+                };
+                m_entity_manager.getUnchecked<Orientation3D>(entity) = Orientation3D{parent_orientation * parent.orientation};
+                m_entity_manager.markChanged<HypersphereOrientation>(entity);
+                m_entity_manager.markChanged<Orientation3D>(entity);
             }
+        });
+    }
+}
 
-            auto& angular_velocity = m_entity_manager.get<AngularVelocity3D>(e);
-            angular_velocity = AngularVelocity3D{0.0, 0.0, 0.0};
-            constexpr auto max_camera_angular_velocity = glm::radians(120.0f) * radian / second;
+void World::orthonormalizationSystem()
+{
+    m_entity_manager.query<HypersphereOrientation>().each().parallelRunBatches(
+        [&](const std::span<const ec_system::Entity> entities, const std::span<HypersphereOrientation> hypersphere_orientations)
+        {
+            motion_batch::orthonormalize(
+                hypersphere_orientations, orthonormalizationTolerance, [&](const size_t i)
+                {
+                    m_entity_manager.markChanged<HypersphereOrientation>(entities[i]);
+                }
+            );
+        });
+}
 
-            if (m_window->isKeyPressed(GLFW_KEY_W))
-            {
-                angular_velocity += glm::normalize(m_entity_manager.get<Orientation3D>(e)[0]) * max_camera_angular_velocity;
-            }
-            if (m_window->isKeyPressed(GLFW_KEY_S))
+void World::removeSubmittedMeshes(const size_t entity_id)
+{
+    for (const size_t mesh_id : m_submitted_meshes[entity_id].mesh_ids)
+    {
+        m_renderer->removeMesh(mesh_id);
+    }
+    m_submitted_meshes[entity_id].mesh_ids.clear();
+    m_submitted_meshes[entity_id].entity = ec_system::Entity();
+}
+
+void World::meshSubmitSystem()
+{
+    using MeshVector = ec_system::Shared<std::vector<Mesh>>;
+
+    // meshes of removed entities or of entities that lost a component of the query are not drawn anymore
+    for (size_t i = 0; i < m_submitted_mesh_entity_ids.size();)
+    {
+        const size_t entity_id = m_submitted_mesh_entity_ids[i];
+        const ec_system::Entity entity = m_submitted_meshes[entity_id].entity;
+        if (
+            m_entity_manager.hasEntity(entity) &&
+            m_entity_manager.has<MeshVector, Orientation3D, HypersphereOrientation>(entity))
+        {
+            ++i;
+            continue;
+        }
+        removeSubmittedMeshes(entity_id);
+        m_submitted_mesh_entity_ids[i] = m_submitted_mesh_entity_ids.back();
+        m_submitted_mesh_entity_ids.pop_back();
+    }
+
+    // only meshes of new or moved objects have to be passed to the renderer
+    const uint32_t since = m_mesh_submit_tick;
+    m_mesh_submit_tick = m_entity_manager.getChangeTick();
+    m_entity_manager.query<ec_system::Shared<std::vector<Mesh>>, Orientation3D, HypersphereOrientation>().each()
+        .changedSince<ec_system::Shared<std::vector<Mesh>>, Orientation3D, HypersphereOrientation>(since).run(
+        [&](
+            const ec_system::Entity entity,
+            const ec_system::Shared<std::vector<Mesh>>& meshes,
+            const Orientation3D& orientation,
+            const HypersphereOrientation& hypersphere_orientation
+        )
+        {
+            if (m_submitted_meshes.size() <= entity.getId())
             {
-                angular_velocity += glm::normalize(m_entity_manager.get<Orientation3D>(e)[0]) * -max_camera_angular_velocity;
+                m_submitted_meshes.resize(entity.getId() + 1);
             }
-            if (m_window->isKeyPressed(GLFW_KEY_A))
+            auto& submitted = m_submitted_meshes[entity.getId()];
+            if (submitted.entity == entity && !m_entity_manager.changed<MeshVector>(entity, since))
             {
-                angular_velocity += glm::normalize(m_entity_manager.get<Orientation3D>(e)[1]) * max_camera_angular_velocity;
+                for (const size_t mesh_id : submitted.mesh_ids)
+                {
+                    m_renderer->updateMesh(mesh_id, hypersphere_orientation, orientation);
+                }
+                return;
             }
-            if (m_window->isKeyPressed(GLFW_KEY_D))
+
+            // new entity or other meshes
+            if (submitted.entity == ec_system::Entity())
             {
-                angular_velocity += glm::normalize(m_entity_manager.get<Orientation3D>(e)[1]) * -max_camera_angular_velocity;
+                m_submitted_mesh_entity_ids.push_back(entity.getId());
             }
-            if (m_window->isKeyPressed(GLFW_KEY_E))
+            else
             {
-                angular_velocity += glm::normalize(m_entity_manager.get<Orientation3D>(e)[2]) * max_camera_angular_velocity;
+                removeSubmittedMeshes(entity.getId());
             }
-            if (m_window->isKeyPressed(GLFW_KEY_Q))
+            submitted.entity = entity;
+            for (const auto& mesh : *meshes)
             {
-                angular_velocity += glm::normalize(m_entity_manager.get<Orientation3D>(e)[2]) * -max_camera_angular_velocity;
+                submitted.mesh_ids.push_back(m_renderer->submitMesh(
+                    {
+                        mesh.texture, mesh.normal_map, mesh.vao,
+                        hypersphere_orientation,
+                        orientation
+                    }));
             }
+        });
+}
 
-        }
-        for (const auto e : m_entity_manager.iterator<HypersphereOrientation, Velocity3D>())
-        {
-            auto& hypersphere_orientation = m_entity_manager.get<HypersphereOrientation>(e);
-            const auto& velocity = m_entity_manager.get<Velocity3D>(e);
-            if (glm::length(velocity.value) > 0.0)
-            {
-                hypersphere_orientation = HypersphereOrientation{glm::hs::getHypersphereOrientation(
-                    hypersphere_orientation, glm::mat3(1.0), (velocity * delta).value, m_radius
-                )};
-            }
-        }
-        for (const auto e : m_entity_manager.iterator<Orientation3D, AngularVelocity3D>())
+void World::lightSubmitSystem()
+{
+    m_entity_manager.query<HypersphereOrientation, Light>().each().run(
+        [&](const HypersphereOrientation& hypersphere_orientation, const Light& light)
         {
-            const Radian<float> delta_value = glm::length(m_entity_manager.get<AngularVelocity3D>(e).value) * radian / second * delta;
-            if (delta_value > 0.0f)
-            {
-                const auto axis = glm::normalize(m_entity_manager.get<AngularVelocity3D>(e).value);
+            m_renderer->submitLight(hypersphere_orientation.coord(), light);
+        });
+}
 
-                m_entity_manager.get<Orientation3D>(e) = Orientation3D{glm::rotate(
-                    glm::mat4(1.0),
-                    delta_value.value,
-                    axis
-                )} * m_entity_manager.get<Orientation3D>(e);
-            }
-        }
-        for (const auto e : m_entity_manager.iterator<std::vector<Mesh>, Orientation3D, HypersphereOrientation>())
+void World::cameraSystem()
+{
+    for (const auto e : m_entity_manager.query<World::Camera, Orientation3D, HypersphereOrientation>())
+    {
+        m_renderer->setCamera({
+                                  m_entity_manager.getUnchecked<HypersphereOrientation>(e),
+                                  m_entity_manager.getUnchecked<Orientation3D>(e),
+                                  m_far_plane,
+                                  m_entity_manager.getUnchecked<World::Camera>(e).field_of_view
+                              });
+        m_camera_entity = e;
+    }
+}
+
+void World::initSystems()
+{
+    using ec_system::Reads;
+    using ec_system::Writes;
+    using Thread = ec_system::SystemScheduler::Thread;
+
+    m_scheduler.addSystem(
+        "camera input",
+        Reads<World::Camera, Orientation3D>{}, Writes<Velocity3D, AngularVelocity3D>{},
+        [&]
+        { cameraInputSystem(); },
+        Thread::main
+    );
+    m_scheduler.addSystem(
+        "motion",
+        Reads<Velocity3D>{}, Writes<HypersphereOrientation>{},
+        [&]
+        { motionSystem(); }
+    );
+    m_scheduler.addSystem(
+        "rotation",
+        Reads<AngularVelocity3D>{}, Writes<Orientation3D>{},
+        [&]
+        { rotationSystem(); }
+    );
+    m_scheduler.addSystem(
+        "transform",
+        Reads<Parent>{}, Writes<HypersphereOrientation, Orientation3D>{},
+        [&]
+        { transformSystem(); }
+    );
+    m_scheduler.addSystem(
+        "mesh submit",
+        Reads<ec_system::Shared<std::vector<Mesh>>, Orientation3D, HypersphereOrientation>{}, Writes<>{},
+        [&]
+        { meshSubmitSystem(); },
+        Thread::main
+    );
+    m_scheduler.addSystem(
+        "light submit",
+        Reads<HypersphereOrientation, Light>{}, Writes<>{},
+        [&]
+        { lightSubmitSystem(); },
+        Thread::main
+    );
+    m_scheduler.addSystem(
+        "camera",
+        Reads<World::Camera, Orientation3D, HypersphereOrientation>{}, Writes<>{},
+        [&]
+        { cameraSystem(); },
+        Thread::main
+    );
+}
+
+void World::spatialSortSystem()
+{
+    // a full sort is a frame time spike, so it is skipped if no entity has been created or moved since the last one
+    bool moved = false;
+    m_entity_manager.query<HypersphereOrientation>().each().changedSince<HypersphereOrientation>(m_spatial_sort_tick).run(
+        [&](const HypersphereOrientation&)
         {
-            for (const auto& mesh : m_entity_manager.get<std::vector<Mesh>>(e))
+            moved = true;
+        });
+    m_spatial_sort_tick = m_entity_manager.getChangeTick();
+    if (moved)
+    {
+        m_entity_manager.sortBy<HypersphereOrientation>(
+            [](const HypersphereOrientation& hypersphere_orientation)
             {
-                m_renderer->submitMesh(
-                    {
-                        mesh.texture, mesh.normal_map, mesh.vao,
-                        m_entity_manager.get<HypersphereOrientation>(e),
-                        m_entity_manager.get<Orientation3D>(e)
-                    });
+                return utility::mortonCode(hypersphere_orientation.coord());
             }
-        }
-        for (const auto e : m_entity_manager.iterator<HypersphereOrientation, Light>())
+        );
+    }
+}
+
+void World::loop()
+{
+    std::chrono::microseconds rendering_time;
+    while (!m_window->shouldClose())
+    {
+        static auto last = std::chrono::high_resolution_clock::now();
+        auto now = std::chrono::high_resolution_clock::now();
+        m_delta = std::chrono::duration_cast<std::chrono::milliseconds>(now - last).count() * milli * second;
+        last = now;
+
+        m_scheduler.run();
+
+        lastOrthonormalization += 1;
+        if (orthonormalizationFrameFrequency > 0 && lastOrthonormalization >= orthonormalizationFrameFrequency)
         {
-            m_renderer->submitLight(
-                m_entity_manager.get<HypersphereOrientation>(e).coord(),
-                m_entity_manager.get<Light>(e)
-            );
+            lastOrthonormalization = 0;
+            orthonormalizationSystem();
         }
-        for (const auto e : m_entity_manager.iterator<World::Camera, Orientation3D, HypersphereOrientation>())
+
+        // no system is running here, so the storage can be reordered. It comes last, because changes until the next
+        // run get the tick that it remembers.
+        lastSpatialSort += 1;
+        if (spatialSortFrameFrequency > 0 && lastSpatialSort >= spatialSortFrameFrequency)
         {
-            m_renderer->setCamera({
-                                      m_entity_manager.get<HypersphereOrientation>(e),
-                                      m_entity_manager.get<Orientation3D>(e),
-                                      m_far_plane,
-                                      m_entity_manager.get<World::Camera>(e).field_of_view
-                                  });
-            m_camera_entity = e;
+            lastSpatialSort = 0;
+            spatialSortSystem();
         }
 
         auto frame_start = std::chrono::high_resolution_clock::now();
@@ -346,6 +706,13 @@ void World::loop()
                 "rendering time: " + std::to_string(rendering_time.count() / 1000.0) + " ms"
             });
             current_row += 1;
+            for (const auto& timing : m_scheduler.getTimings())
+            {
+                utility::text_buffer.setChar(0, current_row, {
+                    "    " + timing.name + ": " + std::to_string(timing.duration.count() / 1000.0) + " ms"
+                });
+                current_row += 1;
+            }
 
             const int cout_width = utility::text_buffer.width() - (logo_width + 12 + 2);
             const int cout_height = utility::text_buffer.height() - current_row - 4;
@@ -369,4 +736,9 @@ void World::loop()
         }
 #endif
     }
+
+    if (!m_snapshot_file.empty())
+    {
+        saveSnapshot(m_snapshot_file);
+    }
 }
\ No newline at end of file
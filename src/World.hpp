@@ -2,6 +2,8 @@
 
 #include <glm/glm.hpp>
 #include "ec_system.hpp"
+#include "ec_system_scheduler.hpp"
+#include "ec_system_snapshot.hpp"
 #include "Window.hpp"
 #include "Renderer.hpp"
 #include "json.hpp"
@@ -9,6 +11,7 @@
 #include "types.hpp"
 #include "Mesh.hpp"
 #include <memory>
+#include <optional>
 
 using namespace physics_units;
 using json = nlohmann::json;
@@ -21,10 +24,17 @@ public:
 
     void loop();
 
+    // Saves all entities with their components. Meshes are stored as the path of their file.
+    void saveSnapshot(const std::filesystem::path& file_path) const;
+
 private:
 
     ec_system::EntityManager m_entity_manager;
 
+    ec_system::SystemScheduler m_scheduler{m_entity_manager};
+
+    Second<float> m_delta = 0.0f * second;
+
     std::shared_ptr<Window> m_window;// = Window(1000, 800, "glome");
     std::shared_ptr<Renderer> m_renderer;// = Renderer(m_window.width(), m_window.height(), 5);
 
@@ -38,13 +48,83 @@ private:
         Radian<float> field_of_view;
     };
 
+    // Places an entity relative to another one. transformSystem() derives the HypersphereOrientation and
+    // Orientation3D of the entity from the ones of the parent whenever one of them or the local transform changed.
+    struct Parent
+    {
+        ec_system::Entity entity;
+        // in the local space of the parent
+        Position3D offset;
+        // relative to the orientation of the parent
+        Orientation3D orientation;
+    };
+
     ec_system::Entity m_camera_entity;
 
+    // if set, the world is restored from this snapshot on start (if it exists) and saved to it on exit
+    std::filesystem::path m_snapshot_file;
+
+    struct SubmittedMeshes
+    {
+        ec_system::Entity entity;
+        std::vector<size_t> mesh_ids;
+    };
+    // meshes that have been passed to the renderer, indexed by entity id. The entity tells whether the entry belongs
+    // to the current entity with that id or to a removed one.
+    std::vector<SubmittedMeshes> m_submitted_meshes;
+    // ids of the entries of m_submitted_meshes that have meshes
+    std::vector<size_t> m_submitted_mesh_entity_ids;
+    uint32_t m_mesh_submit_tick = 0;
+
+    void removeSubmittedMeshes(size_t entity_id);
+
+    // entities with a parent grouped by their depth in the hierarchy, parents are updated before their children
+    std::vector<std::vector<ec_system::Entity>> m_transform_batches;
+    uint32_t m_transform_tick = 0;
+
     std::vector<std::string> m_ascii_framebuffer_debug_name_list;
     json m_ascii_framebuffer_json;
     static constexpr int printFramebufferFrameFrequencey = 15;
+    // entities are sorted by their position on the hypersphere every this many frames, 0 disables it
+    static constexpr int spatialSortFrameFrequency = 120;
+    int lastSpatialSort = 0;
+    uint32_t m_spatial_sort_tick = 0;
+    // hypersphere orientations are re-orthonormalized every this many frames, if they drifted more than the tolerance
+    static constexpr int orthonormalizationFrameFrequency = 60;
+    // largest deviation of a dot product of two axes from the identity, see glm::hs::orthonormalityError(). The batched
+    // path in motion_batch.hpp uses the same measure.
+    static constexpr float orthonormalizationTolerance = 1e-5f;
+    int lastOrthonormalization = 0;
     int lastFramebufferPrint = 0;
 
+    void initSystems();
+
+    void restoreSnapshot(const std::filesystem::path& file_path);
+
+    // objects in "children" are placed relative to the object by their "offset" and "orientation"
+    void loadObject(const json& object, std::optional<ec_system::Entity> parent = std::nullopt);
+
+    // objects that use the same model file share one copy of its meshes
+    ec_system::Shared<std::vector<Mesh>> loadMeshes(const std::filesystem::path& file_path);
+
+    void cameraInputSystem();
+
+    void motionSystem();
+
+    void rotationSystem();
+
+    void transformSystem();
+
+    void orthonormalizationSystem();
+
+    void spatialSortSystem();
+
+    void meshSubmitSystem();
+
+    void lightSubmitSystem();
+
+    void cameraSystem();
+
     void addComponentFromJsonOrientation3D(const json& object, const ec_system::Entity& entity);
 
     void addComponentFromJsonAngularVelocity3D(const json& object, const ec_system::Entity& entity);
@@ -80,4 +160,49 @@ private:
         {"camera",           [&](const auto& j, const auto& e)
                              { addComponentFromJsonCamera(j, e); }}
     };
-};
\ No newline at end of file
+};
+
+EC_SYSTEM_REGISTER_COMPONENT(Orientation3D, 0)
+EC_SYSTEM_REGISTER_COMPONENT(AngularVelocity3D, 1)
+EC_SYSTEM_REGISTER_COMPONENT(HypersphereOrientation, 2)
+EC_SYSTEM_REGISTER_COMPONENT(Velocity3D, 3)
+EC_SYSTEM_REGISTER_COMPONENT(ec_system::Shared<std::vector<Mesh>>, 4)
+EC_SYSTEM_REGISTER_COMPONENT(Name, 5)
+EC_SYSTEM_REGISTER_COMPONENT(Light, 6)
+EC_SYSTEM_REGISTER_COMPONENT(World::Camera, 7)
+EC_SYSTEM_REGISTER_COMPONENT(MeshFile, 8)
+EC_SYSTEM_REGISTER_COMPONENT(World::Parent, 9)
+
+// there is only one camera, it doesn't need its own archetype
+template<>
+struct ec_system::SparseSetStorage<World::Camera> : std::true_type
+{
+};
+
+template<>
+struct ec_system::SnapshotSerializer<Name>
+{
+    static void write(std::vector<char>& out, const Name& name)
+    {
+        SnapshotSerializer<std::string>::write(out, name);
+    }
+
+    static Name read(SnapshotReader& in)
+    {
+        return Name{SnapshotSerializer<std::string>::read(in)};
+    }
+};
+
+template<>
+struct ec_system::SnapshotSerializer<MeshFile>
+{
+    static void write(std::vector<char>& out, const MeshFile& mesh_file)
+    {
+        SnapshotSerializer<std::string>::write(out, mesh_file.string());
+    }
+
+    static MeshFile read(SnapshotReader& in)
+    {
+        return MeshFile{SnapshotSerializer<std::string>::read(in)};
+    }
+};
@@ -1,29 +1,49 @@
 #pragma once
 
 #include <stdexcept>
+#include <cstdint>
 #include <bitset>
 #include <vector>
+#include <array>
 #include <memory>
 #include <functional>
 #include <cassert>
-#include <any>
 #include <algorithm>
-#include <optional>
+#include <unordered_map>
+#include <type_traits>
+#include <string>
+#include <atomic>
+#include <span>
+#include <tuple>
+#include <mutex>
+#include "thread_pool.hpp"
 
 namespace ec_system
 {
+    class SystemScheduler;
+
+    class EntityCommandBuffer;
+
+    class Snapshot;
+
+    // Handle of an entity. The index of a removed entity gets reused, but its version is incremented,
+    // so stale handles never refer to the new entity.
     class Entity
     {
         friend class EntityManager;
 
+        friend class EntityCommandBuffer;
+
+        friend class Snapshot;
+
     public:
 
-        Entity() : m_id(SIZE_MAX)
+        Entity() : m_index(UINT32_MAX), m_version(0)
         {}
 
         bool operator==(const Entity& b) const
         {
-            return (this->m_id == b.m_id);
+            return this->m_index == b.m_index && this->m_version == b.m_version;
         }
 
         bool operator!=(const Entity& b) const
@@ -33,34 +53,145 @@ namespace ec_system
 
         [[nodiscard]] size_t getId() const
         {
-            return m_id;
+            return m_index;
+        }
+
+        [[nodiscard]] uint32_t getVersion() const
+        {
+            return m_version;
         }
 
     private:
 
-        explicit Entity(size_t id) : m_id(id)
+        Entity(const uint32_t index, const uint32_t version) : m_index(index), m_version(version)
         {}
 
-        size_t m_id;
+        uint32_t m_index;
+        uint32_t m_version;
     };
 
-    class EntityManager
+    static_assert(sizeof(Entity) == 8);
+
+    // Specialize as std::true_type to store a component type in a sparse set instead of the archetype tables.
+    // Adding or removing such a component is O(1) and doesn't move the other components of the entity,
+    // which pays off for components that only few entities have or that get added and removed often.
+    template<typename T>
+    struct SparseSetStorage : std::false_type
+    {
+    };
+
+    // Query filters for EntityManager::iterator() and EntityManager::each(), e.g.
+    //     entity_manager.each<Mesh, Optional<Light>, Without<Camera>>().run([](Mesh& mesh, Light* light) {...});
+    // Without<T> skips entities that have a T and isn't passed to the function. Optional<T> doesn't filter, the
+    // function gets a T* that is nullptr if the entity has no T.
+    template<typename T>
+    struct Without
+    {
+    };
+
+    template<typename T>
+    struct Optional
     {
+    };
+
+    // Immutable value that many entities can reference as component, e.g. the meshes of a model file. Copies point
+    // to the same value, which is destroyed together with the last reference. EntityManager::share() returns the same
+    // value for the same key as long as it is referenced, so memory scales with the number of distinct values
+    // instead of the number of entities. Entities that reference the same value have equal Shared<T> components.
+    template<typename T>
+    class Shared
+    {
+        friend class EntityManager;
+
+    public:
+
+        Shared() = default;
+
+        explicit Shared(T value) : m_value(std::make_shared<const T>(std::move(value)))
+        {}
+
+        const T& operator*() const
+        {
+            assert(m_value != nullptr);
+            return *m_value;
+        }
+
+        const T* operator->() const
+        {
+            return m_value.get();
+        }
+
+        [[nodiscard]] const T* get() const
+        {
+            return m_value.get();
+        }
+
+        bool operator==(const Shared& a) const
+        {
+            return m_value == a.m_value;
+        }
+
+    private:
+
+        explicit Shared(std::shared_ptr<const T> value) : m_value(std::move(value))
+        {}
+
+        std::shared_ptr<const T> m_value;
+    };
+
 #ifndef MAX_NUM_COMPONENT_TYPES
 #define MAX_NUM_COMPONENT_TYPES 64
 #endif
 
+#ifndef MAX_NUM_REGISTERED_COMPONENT_TYPES
+#define MAX_NUM_REGISTERED_COMPONENT_TYPES 32
+#endif
+
+    // Component types with a registered id (see EC_SYSTEM_REGISTER_COMPONENT) have a type id that is known at
+    // compile time. All other component types get an id at runtime when they are used for the first time.
+    template<typename T>
+    struct ComponentTypeId
+    {
+        static constexpr size_t value = SIZE_MAX;
+    };
+
+#define EC_SYSTEM_REGISTER_COMPONENT(type, id)\
+template<>\
+struct ec_system::ComponentTypeId<type>\
+{\
+  static_assert((id) < MAX_NUM_REGISTERED_COMPONENT_TYPES, "Registered component id is too big.");\
+  static constexpr size_t value = (id);\
+};
+
+    class EntityManager
+    {
+        friend class SystemScheduler;
+
+        friend class EntityCommandBuffer;
+
+        friend class Snapshot;
+
+        using Mask = std::bitset<MAX_NUM_COMPONENT_TYPES>;
+
         template<typename... Targs>
         class Iterator;
 
         template<typename C, typename... Targs>
         class Each;
 
+        template<typename... Targs>
+        class View;
+
+        struct QueryCache;
+
     public:
 
+        template<typename... Targs>
+        class Query;
+
         EntityManager()
         {
-            num_components.fill(0);
+            getArchetype(Mask(1));
         }
 
         EntityManager(const EntityManager&) = delete;
@@ -69,34 +200,177 @@ namespace ec_system
 
         Entity createEntity()
         {
+            assert(num_active_parallel_runs == 0 && "Structural changes are not allowed during parallelRun().");
+            flushReservedEntities();
             size_t id;
             if (unused_ids.empty())
             {
                 id = has_mask.size();
+                if (id >= max_num_entities)
+                {
+                    throw std::runtime_error(
+                        std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                        "Can't create entity. Too many entities.");
+                }
                 has_mask.emplace_back(1);
+                entity_locations.emplace_back();
+                versions.push_back(0);
             }
             else
             {
                 id = unused_ids.back();
                 unused_ids.pop_back();
+                free_cursor.store(static_cast<int64_t>(unused_ids.size()), std::memory_order_relaxed);
                 assert(has_mask[id].none());
-                has_mask[id] = std::bitset<MAX_NUM_COMPONENT_TYPES>(1);
+                has_mask[id] = Mask(1);
             }
-            assert(!(id >= has_mask.size()) && has_mask[id].test(0));
-            return Entity(id);
+            return addToEmptyArchetype(id);
+        }
+
+        // Returns the handle of an entity that is created by the next structural change, e.g. when a command
+        // buffer is applied. Thread safe and lock free, so systems can spawn entities without a sync point: the
+        // handle can be used for commands of an EntityCommandBuffer right away. hasEntity() is false until then.
+        Entity reserveEntity()
+        {
+            const int64_t cursor = free_cursor.fetch_sub(1, std::memory_order_relaxed);
+            if (cursor > 0)
+            {
+                const size_t id = unused_ids[static_cast<size_t>(cursor - 1)];
+                return Entity(static_cast<uint32_t>(id), versions[id]);
+            }
+            const size_t id = versions.size() + static_cast<size_t>(-cursor);
+            if (id >= max_num_entities)
+            {
+                throw std::runtime_error(
+                    std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                    "Can't reserve entity. Too many entities.");
+            }
+            return Entity(static_cast<uint32_t>(id), 0);
+        }
+
+        // Creates all entities returned by reserveEntity() so far. Structural changes do this first.
+        void flushReservedEntities()
+        {
+            const int64_t cursor = free_cursor.load(std::memory_order_relaxed);
+            if (cursor == static_cast<int64_t>(unused_ids.size()))
+            {
+                return;
+            }
+            assert(num_active_parallel_runs == 0 && "Structural changes are not allowed during parallelRun().");
+            const size_t num_reused = unused_ids.size() - static_cast<size_t>(std::max<int64_t>(cursor, 0));
+            const size_t num_new = cursor < 0 ? std::min(static_cast<size_t>(-cursor), max_num_entities - versions.size()) : 0;
+            reserveEntities(num_reused + num_new);
+            for (size_t i = 0; i < num_reused; ++i)
+            {
+                const size_t id = unused_ids.back();
+                unused_ids.pop_back();
+                assert(has_mask[id].none());
+                has_mask[id] = Mask(1);
+                addToEmptyArchetype(id);
+            }
+            for (size_t i = 0; i < num_new; ++i)
+            {
+                has_mask.emplace_back(1);
+                entity_locations.emplace_back();
+                versions.push_back(0);
+                addToEmptyArchetype(has_mask.size() - 1);
+            }
+            free_cursor.store(static_cast<int64_t>(unused_ids.size()), std::memory_order_relaxed);
         }
 
         [[nodiscard]] bool hasEntity(const Entity entity) const
         {
-            if (entity.m_id >= has_mask.size())
+            return
+                entity.m_index < versions.size() && versions[entity.m_index] == entity.m_version &&
+                has_mask[entity.m_index].test(0);
+        }
+
+        // Creates num_entities entities at once. Entity i gets the components components[i]..., the new rows of
+        // the archetype are filled with one range insert per component type.
+        template<typename... Targs>
+        std::vector<Entity> createEntities(const size_t num_entities, std::span<const Targs>... components)
+        {
+            if (((components.size() != num_entities) || ...))
             {
-                return false;
+                throw std::runtime_error(
+                    std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                    "Can't create entities. Number of components doesn't match number of entities.");
+            }
+
+            flushReservedEntities();
+            if (num_entities > unused_ids.size() && has_mask.size() + (num_entities - unused_ids.size()) > max_num_entities)
+            {
+                throw std::runtime_error(
+                    std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                    "Can't create entities. Too many entities.");
+            }
+            assert(num_active_parallel_runs == 0 && "Structural changes are not allowed during parallelRun().");
+
+            (registerComponentType<Targs>(), ...);
+            const Mask mask = queryMask<Targs...>();
+            assert(mask.count() == sizeof...(Targs) + 1 && "Component types have to be unique.");
+            const size_t archetype_index = getArchetype(mask & ~sparse_set_mask);
+            Archetype& archetype = *archetypes[archetype_index];
+
+            reserveEntities(num_entities);
+            archetype.reserve(num_entities);
+            std::vector<Entity> entities;
+            entities.reserve(num_entities);
+            for (size_t i = 0; i < num_entities; ++i)
+            {
+                size_t id;
+                if (unused_ids.empty())
+                {
+                    id = has_mask.size();
+                    has_mask.emplace_back();
+                    entity_locations.emplace_back();
+                    versions.push_back(0);
+                }
+                else
+                {
+                    id = unused_ids.back();
+                    unused_ids.pop_back();
+                    assert(has_mask[id].none());
+                }
+                has_mask[id] = mask;
+                entity_locations[id] = {archetype_index, archetype.entities.size()};
+                entities.push_back(Entity(static_cast<uint32_t>(id), versions[id]));
+                archetype.entities.push_back(entities.back());
+            }
+            free_cursor.store(static_cast<int64_t>(unused_ids.size()), std::memory_order_relaxed);
+
+            ([&]
+            {
+                if constexpr (SparseSetStorage<Targs>::value)
+                {
+                    auto& sparse_set = static_cast<SparseSet<Targs>&>(*sparse_sets[type_id < Targs > ]);
+                    for (size_t i = 0; i < num_entities; ++i)
+                    {
+                        sparse_set.insert(entities[i], Targs(components[i]), change_tick);
+                    }
+                }
+                else
+                {
+                    auto& column = archetype.template column<Targs>();
+                    column.insert(column.end(), components.begin(), components.end());
+                    auto& change_ticks = archetype.columns[type_id < Targs > ]->change_ticks;
+                    change_ticks.insert(change_ticks.end(), num_entities, change_tick);
+                }
+            }(), ...);
+
+            if (!sparse_query_caches.empty())
+            {
+                for (const Entity entity : entities)
+                {
+                    addToQueryCaches(entity, mask);
+                }
             }
-            return has_mask[entity.m_id].test(0);
+            return entities;
         }
 
         void removeEntity(const Entity entity)
         {
+            flushReservedEntities();
             if (!hasEntity(entity))
             {
                 // TODO: replace exceptions with assert variant
@@ -104,13 +378,32 @@ namespace ec_system
                     std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
                     "Can't remove entity. Entity doesn't exists.");
             }
-            has_mask[entity.m_id] = std::bitset<MAX_NUM_COMPONENT_TYPES>(0);
-            unused_ids.emplace_back(entity.m_id);
+            assert(num_active_parallel_runs == 0 && "Structural changes are not allowed during parallelRun().");
+            removeFromQueryCaches(entity, has_mask[entity.m_index]);
+            const EntityLocation location = entity_locations[entity.m_index];
+            removeRow(location.archetype, location.row);
+            const Mask sparse_set_components = has_mask[entity.m_index] & sparse_set_mask;
+            for (size_t id = 0; sparse_set_components.any() && id + 1 < MAX_NUM_COMPONENT_TYPES; ++id)
+            {
+                if (sparse_set_components.test(id + 1))
+                {
+                    sparse_sets[id]->remove(entity.m_index);
+                }
+            }
+            has_mask[entity.m_index] = Mask(0);
+            // an index whose version would wrap around is never reused
+            versions[entity.m_index] += 1;
+            if (versions[entity.m_index] != UINT32_MAX)
+            {
+                unused_ids.emplace_back(entity.m_index);
+                free_cursor.store(static_cast<int64_t>(unused_ids.size()), std::memory_order_relaxed);
+            }
         }
 
         template<typename T, typename... Args>
         void createComponent(const Entity entity, Args&& ... args)
         {
+            flushReservedEntities();
             if (!hasEntity(entity))
             {
                 throw std::runtime_error(
@@ -123,24 +416,32 @@ namespace ec_system
                     std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
                     "Can't create component. Component already exists.");
             }
+            assert(num_active_parallel_runs == 0 && "Structural changes are not allowed during parallelRun().");
 
-            if (component_vectors.get<T>().size() <= entity.m_id)
+            registerComponentType<T>();
+            if constexpr (SparseSetStorage<T>::value)
             {
-                component_vectors.get<T>().resize(entity.m_id + 1);
+                static_cast<SparseSet<T>&>(*sparse_sets[type_id < T > ]).insert(
+                    entity, T{std::forward<Args>(args)...}, change_tick
+                );
             }
+            else
+            {
+                T component = T{std::forward<Args>(args)...};
 
-            has_mask[entity.m_id] |= bit_id<T>;
-
-            component_vectors.get<T>()[entity.m_id] = T{std::forward<Args>(args)...};
-
-            num_components[type_id < T > ] += 1;
+                const size_t to_archetype = getAddEdge<T>(entity_locations[entity.m_index].archetype);
+                moveEntity(entity, to_archetype);
+                archetypes[to_archetype]->template pushBack<T>(std::move(component), change_tick);
+            }
 
-            component_type_list[type_id < T > ].push_back(entity);
+            has_mask[entity.m_index] |= bit_id<T>;
+            addToQueryCaches(entity, bit_id<T>);
         }
 
         template<typename T>
         void removeComponent(const Entity entity)
         {
+            flushReservedEntities();
             if (!hasEntity(entity))
             {
                 throw std::runtime_error(
@@ -153,18 +454,19 @@ namespace ec_system
                     std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
                     "Can't remove component. Component doesn't exists.");
             }
-            has_mask[entity.m_id] &= ~bit_id<T>;
-
-            num_components[type_id < T > ] -= 1;
+            assert(num_active_parallel_runs == 0 && "Structural changes are not allowed during parallelRun().");
+            removeFromQueryCaches(entity, bit_id<T>);
 
-            for (size_t i = 0; i < component_type_list[type_id < T > ].size(); ++i)
+            if constexpr (SparseSetStorage<T>::value)
             {
-                if (component_type_list[type_id < T > ][i] == entity)
-                {
-                    component_type_list[type_id < T > ].erase(component_type_list[type_id < T > ].begin() + i);
-                    break;
-                }
+                sparse_sets[type_id < T > ]->remove(entity.m_index);
             }
+            else
+            {
+                moveEntity(entity, getRemoveEdge<T>(entity_locations[entity.m_index].archetype));
+            }
+
+            has_mask[entity.m_index] &= ~bit_id<T>;
         }
 
         template<typename T>
@@ -182,9 +484,7 @@ namespace ec_system
                     std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
                     "Can't access component. Component doesn't exists.");
             }
-            assert(component_vectors.get<T>().size() > entity.m_id);
-            assert(component_vectors.get<T>()[entity.m_id].has_value());
-            return *(component_vectors.get<T>()[entity.m_id]);
+            return component<T>(entity);
         }
 
         template<typename T>
@@ -202,19 +502,178 @@ namespace ec_system
                     std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
                     "Can't access component. Component doesn't exists.");
             }
-            assert(component_vectors.get<T>().size() > entity.m_id);
-            assert(component_vectors.get<T>()[entity.m_id].has_value());
-            return *(component_vectors.get<T>()[entity.m_id]);
+            return component<T>(entity);
+        }
+
+        // Like get() but only checks with assert whether the entity and the component exist.
+        template<typename T>
+        T& getUnchecked(const Entity entity)
+        {
+            assert(hasEntity(entity));
+            assert(has<T>(entity));
+            return component<T>(entity);
+        }
+
+        template<typename T>
+        const T& getUnchecked(const Entity entity) const
+        {
+            assert(hasEntity(entity));
+            assert(has<T>(entity));
+            return component<T>(entity);
         }
 
         template<typename... Targs>
         [[nodiscard]] bool has(const Entity entity) const
         {
-            if (entity.m_id >= has_mask.size())
+            if (!hasEntity(entity))
             {
                 return false;
             }
-            return (has_mask[entity.m_id] & BitTypeId::get<Targs...>()) == BitTypeId::get<Targs...>();
+            return (has_mask[entity.m_index] & BitTypeId::get<Targs...>()) == BitTypeId::get<Targs...>();
+        }
+
+        template<typename... Targs>
+        static std::bitset<MAX_NUM_COMPONENT_TYPES> componentMask()
+        {
+            if constexpr (sizeof...(Targs) == 0)
+            {
+                return Mask(0);
+            }
+            else
+            {
+                return BitTypeId::get<Targs...>();
+            }
+        }
+
+        // Every created component and every component passed to markChanged() gets the current change tick.
+        // Consumers remember the tick at which they last looked at the components and only process components
+        // with a newer tick, see changed() and Each::changedSince().
+        [[nodiscard]] uint32_t getChangeTick() const
+        {
+            return change_tick;
+        }
+
+        // The SystemScheduler calls this before each wave of systems.
+        void advanceChangeTick()
+        {
+            change_tick += 1;
+        }
+
+        // May be called during parallelRun() for the components of the visited entity.
+        template<typename T>
+        void markChanged(const Entity entity)
+        {
+            assert(hasEntity(entity));
+            assert(has<T>(entity));
+            changeTick(type_id<T>, entity) = change_tick;
+        }
+
+        // whether the component has been created or marked as changed after the tick since
+        template<typename T>
+        [[nodiscard]] bool changed(const Entity entity, const uint32_t since) const
+        {
+            return has<T>(entity) && isNewer(changeTick(type_id<T>, entity), since);
+        }
+
+        // Reorders the rows of every archetype that contains T by key(component) (smallest first), e.g. by a space
+        // filling curve, so that passes that visit neighbouring entities one after another touch neighbouring
+        // memory. Entity handles stay valid. Archetypes that are already sorted are only checked.
+        template<typename T, typename F>
+        void sortBy(F key)
+        {
+            static_assert(!SparseSetStorage<T>::value, "Only archetype components can be sorted.");
+            assert(num_active_parallel_runs == 0 && "Structural changes are not allowed during parallelRun().");
+            std::vector<std::pair<decltype(key(std::declval<const T&>())), size_t>> keys;
+            std::vector<size_t> order;
+            for (const auto& archetype : archetypes)
+            {
+                if (archetype->columns[type_id < T > ] == nullptr || archetype->entities.size() < 2)
+                {
+                    continue;
+                }
+                const auto& column = archetype->template column<T>();
+                keys.clear();
+                for (size_t row = 0; row < column.size(); ++row)
+                {
+                    keys.emplace_back(key(column[row]), row);
+                }
+                if (std::is_sorted(keys.begin(), keys.end()))
+                {
+                    continue;
+                }
+                std::sort(keys.begin(), keys.end());
+
+                order.clear();
+                for (const auto& [k, row] : keys)
+                {
+                    order.push_back(row);
+                }
+                for (auto& permuted_column : archetype->columns)
+                {
+                    if (permuted_column != nullptr)
+                    {
+                        permuted_column->permute(order);
+                    }
+                }
+                std::vector<Entity> entities;
+                entities.reserve(order.size());
+                for (size_t row = 0; row < order.size(); ++row)
+                {
+                    entities.push_back(archetype->entities[order[row]]);
+                    entity_locations[entities.back().m_index].row = row;
+                }
+                archetype->entities = std::move(entities);
+            }
+        }
+
+        // Returns the shared value of type T for key. make() is only called to create the value if no entity
+        // references a value for key anymore. May be called from systems that run concurrently.
+        template<typename T, typename F>
+        Shared<T> share(const std::string& key, F make)
+        {
+            std::lock_guard<std::mutex> lock(shared_values_mutex);
+            auto& values = shared_values[type_id<Shared<T>>];
+            if (values == nullptr)
+            {
+                values = std::make_unique<SharedValues<T>>();
+            }
+            auto& value = static_cast<SharedValues<T>&>(*values).values[key];
+            std::shared_ptr<const T> ret = value.lock();
+            if (ret == nullptr)
+            {
+                ret = std::make_shared<const T>(make());
+                value = ret;
+            }
+            return Shared<T>(std::move(ret));
+        }
+
+        // Pool used by Each::parallelRun(). If none is set, thread_pool::ThreadPool::getDefault() is used.
+        void setThreadPool(thread_pool::ThreadPool* pool)
+        {
+            worker_pool = pool;
+        }
+
+        // Calls f(begin, end) for ranges of [0, size) on the pool of parallelRun(), for entities that aren't visited
+        // in query order. Structural changes are not allowed until it returns, as during parallelRun().
+        template<typename F>
+        void parallelFor(const size_t size, const size_t grain, F f)
+        {
+            struct ParallelRunGuard
+            {
+                explicit ParallelRunGuard(EntityManager& entity_manager) : guarded_em(entity_manager)
+                {
+                    guarded_em.num_active_parallel_runs += 1;
+                }
+
+                ~ParallelRunGuard()
+                {
+                    guarded_em.num_active_parallel_runs -= 1;
+                }
+
+                EntityManager& guarded_em;
+            } guard(*this);
+
+            getThreadPool().parallelFor(size, grain, f);
         }
 
         template<typename... Targs>
@@ -241,6 +700,26 @@ namespace ec_system
             return Each<const EntityManager, Targs...>(*this);
         }
 
+        // Returns a persistent query for Targs... whose result is updated on every structural change, so iterating
+        // over it doesn't need to filter. Only the first call for a combination of component types builds the cache.
+        // May be called from systems that run concurrently.
+        template<typename... Targs>
+        Query<Targs...> query()
+        {
+            static_assert(!has_filters<Targs...>, "Without<> and Optional<> are only supported by iterator() and each().");
+            return Query<Targs...>(*this, getQueryCache<Targs...>());
+        }
+
+        // Range over the components of all entities that have Targs..., e.g.
+        //     for (auto [orientation, velocity] : entity_manager.view<Orientation3D, Velocity3D>()) {...}
+        // The component arrays of an archetype are looked up once, not once per entity.
+        template<typename... Targs>
+        View<Targs...> view()
+        {
+            static_assert(!has_filters<Targs...>, "Without<> and Optional<> are only supported by iterator() and each().");
+            return View<Targs...>(*this, getQueryCache<Targs...>());
+        }
+
     private:
 
         class TypeId
@@ -260,16 +739,26 @@ namespace ec_system
 
             static size_t getUniqueId()
             {
-                const size_t unique_id = counter;
-                counter += 1;
-                return unique_id;
+                return counter.fetch_add(1);
             }
 
-            static inline size_t counter = 0;
+            static inline std::atomic<size_t> counter = MAX_NUM_REGISTERED_COMPONENT_TYPES;
+        };
+
+        template<typename T, bool registered = (ComponentTypeId<T>::value != SIZE_MAX)>
+        struct TypeIdValue
+        {
+            static inline const size_t value = TypeId::get<T>();
+        };
+
+        template<typename T>
+        struct TypeIdValue<T, true>
+        {
+            static constexpr size_t value = ComponentTypeId<T>::value;
         };
 
         template<typename T>
-        const static inline auto type_id = TypeId::get<T>();
+        const static inline auto type_id = TypeIdValue<T>::value;
 
         class BitTypeId
         {
@@ -290,7 +779,7 @@ namespace ec_system
             template<typename T>
             static inline auto getBitIdUnion()
             {
-                static const auto unique_bit_id = std::bitset<MAX_NUM_COMPONENT_TYPES>(0b10 << type_id<T>);
+                static const auto unique_bit_id = type_id<T> + 1 < MAX_NUM_COMPONENT_TYPES ? Mask(1) << (type_id<T> + 1) : Mask(0);
                 if (unique_bit_id.none())
                 {
                     throw std::runtime_error(
@@ -310,159 +799,1384 @@ namespace ec_system
         template<typename T>
         const static inline auto bit_id = BitTypeId::get<T>();
 
-        class ComponentVectors
+        template<typename T>
+        struct QueryTerm
         {
-        public:
-            template<typename T>
-            std::vector<std::optional<T>>& get()
+            using Component = T;
+            static constexpr bool excluded = false;
+            static constexpr bool optional = false;
+        };
+
+        template<typename T>
+        struct QueryTerm<Without<T>>
+        {
+            using Component = T;
+            static constexpr bool excluded = true;
+            static constexpr bool optional = false;
+        };
+
+        template<typename T>
+        struct QueryTerm<Optional<T>>
+        {
+            using Component = T;
+            static constexpr bool excluded = false;
+            static constexpr bool optional = true;
+        };
+
+        template<typename... Targs>
+        static constexpr bool has_filters = ((QueryTerm<Targs>::excluded || QueryTerm<Targs>::optional) || ...);
+
+        // Mask an archetype has to contain to be visited when iterating over Targs...
+        template<typename... Targs>
+        static const Mask& queryMask()
+        {
+            static const Mask mask = []
             {
-                if (!(component_vectors.size() > type_id < T > ))
+                if constexpr ((std::is_void_v<Targs> && ...))
                 {
-                    component_vectors.resize(type_id < T > +1);
+                    return Mask(1);
                 }
-                if (!component_vectors[type_id < T > ].has_value())
+                else
                 {
-                    component_vectors[type_id < T > ] = std::vector<std::optional<T>>();
+                    Mask ret(1);
+                    ([&]
+                    {
+                        if constexpr (!QueryTerm<Targs>::excluded && !QueryTerm<Targs>::optional)
+                        {
+                            ret |= bit_id<Targs>;
+                        }
+                    }(), ...);
+                    return ret;
                 }
-                return std::any_cast<std::vector<std::optional<T>>&>(component_vectors[type_id < T > ]);
-            }
+            }();
+            return mask;
+        }
 
-            template<typename T>
-            const std::vector<std::optional<T>>& get() const
+        // Mask of the components an entity must not have to be visited when iterating over Targs...
+        template<typename... Targs>
+        static const Mask& excludedMask()
+        {
+            static const Mask mask = []
             {
-                static const std::vector<std::optional<T>> empty_vector;
-                if (
-                    !(component_vectors.size() > type_id < T > ) ||
-                    !component_vectors[type_id < T > ].has_value()
-                    )
+                Mask ret;
+                ([&]
                 {
-                    return empty_vector;
-                }
-                return std::any_cast<const std::vector<std::optional<T>>&>(component_vectors[type_id < T > ]);
-            }
-
-        private:
-            std::vector<std::any> component_vectors;
-        };
+                    if constexpr (QueryTerm<Targs>::excluded)
+                    {
+                        ret |= bit_id<typename QueryTerm<Targs>::Component>;
+                    }
+                }(), ...);
+                return ret;
+            }();
+            return mask;
+        }
 
-        ComponentVectors component_vectors;
+        // sparse set components aren't part of the archetype mask, so excluding them has to be checked per entity
+        template<typename... Targs>
+        static constexpr bool excludes_sparse_sets =
+            ((QueryTerm<Targs>::excluded && SparseSetStorage<typename QueryTerm<Targs>::Component>::value) || ...);
 
-        std::vector<std::bitset<MAX_NUM_COMPONENT_TYPES>> has_mask;
+        template<typename... Targs>
+        static bool matchesQuery(const Mask& mask)
+        {
+            return (mask & queryMask<Targs...>()) == queryMask<Targs...>() && (mask & excludedMask<Targs...>()).none();
+        }
+
+        class ComponentColumnBase
+        {
+        public:
+            virtual ~ComponentColumnBase() = default;
+
+            [[nodiscard]] virtual std::unique_ptr<ComponentColumnBase> createEmpty() const = 0;
+
+            // appends the component at position row of other to this column
+            virtual void pushBackFrom(ComponentColumnBase& other, size_t row) = 0;
+
+            // replaces the component at position row with the last component of this column
+            virtual void swapAndPop(size_t row) = 0;
+
+            virtual void reserve(size_t capacity) = 0;
+
+            // row i gets the component that was at row order[i]
+            virtual void permute(const std::vector<size_t>& order) = 0;
+
+            // change tick of every row, see markChanged()
+            std::vector<uint32_t> change_ticks;
+        };
+
+        template<typename T>
+        class ComponentColumn : public ComponentColumnBase
+        {
+        public:
+            [[nodiscard]] std::unique_ptr<ComponentColumnBase> createEmpty() const override
+            {
+                return std::make_unique<ComponentColumn<T>>();
+            }
+
+            void pushBackFrom(ComponentColumnBase& other, const size_t row) override
+            {
+                auto& other_data = static_cast<ComponentColumn<T>&>(other).data;
+                assert(row < other_data.size());
+                data.push_back(std::move(other_data[row]));
+                change_ticks.push_back(other.change_ticks[row]);
+            }
+
+            void swapAndPop(const size_t row) override
+            {
+                assert(row < data.size());
+                if (row + 1 != data.size())
+                {
+                    data[row] = std::move(data.back());
+                    change_ticks[row] = change_ticks.back();
+                }
+                data.pop_back();
+                change_ticks.pop_back();
+            }
+
+            void reserve(const size_t capacity) override
+            {
+                data.reserve(capacity);
+                change_ticks.reserve(capacity);
+            }
+
+            void permute(const std::vector<size_t>& order) override
+            {
+                assert(order.size() == data.size());
+                std::vector<T> permuted_data;
+                std::vector<uint32_t> permuted_change_ticks;
+                permuted_data.reserve(data.size());
+                permuted_change_ticks.reserve(data.size());
+                for (const size_t row : order)
+                {
+                    permuted_data.push_back(std::move(data[row]));
+                    permuted_change_ticks.push_back(change_ticks[row]);
+                }
+                data = std::move(permuted_data);
+                change_ticks = std::move(permuted_change_ticks);
+            }
+
+            std::vector<T> data;
+        };
+
+        static constexpr size_t sparse_page_size = 4096;
+
+        // Dense array of entities plus a paged sparse index from entity id to dense position.
+        // Pages of the sparse index are only allocated for id ranges that are actually used.
+        class EntitySet
+        {
+        public:
+            void insert(const Entity entity)
+            {
+                assert(index(entity.m_index) == SIZE_MAX);
+                setIndex(entity.m_index, dense.size());
+                dense.push_back(entity);
+            }
+
+            // removes the entity with the given id using swap-and-pop, returns its former position
+            size_t erase(const size_t id)
+            {
+                const size_t i = index(id);
+                assert(i != SIZE_MAX);
+                if (i + 1 != dense.size())
+                {
+                    dense[i] = dense.back();
+                    setIndex(dense[i].m_index, i);
+                }
+                dense.pop_back();
+                setIndex(id, SIZE_MAX);
+                return i;
+            }
+
+            [[nodiscard]] size_t index(const size_t id) const
+            {
+                const size_t page = id / sparse_page_size;
+                if (page >= sparse.size() || sparse[page] == nullptr)
+                {
+                    return SIZE_MAX;
+                }
+                return (*sparse[page])[id % sparse_page_size];
+            }
+
+            [[nodiscard]] bool contains(const size_t id) const
+            {
+                return index(id) != SIZE_MAX;
+            }
+
+            [[nodiscard]] const std::vector<Entity>& entities() const
+            {
+                return dense;
+            }
+
+        private:
+            void setIndex(const size_t id, const size_t dense_index)
+            {
+                const size_t page = id / sparse_page_size;
+                if (page >= sparse.size())
+                {
+                    sparse.resize(page + 1);
+                }
+                if (sparse[page] == nullptr)
+                {
+                    sparse[page] = std::make_unique<std::array<size_t, sparse_page_size>>();
+                    sparse[page]->fill(SIZE_MAX);
+                }
+                (*sparse[page])[id % sparse_page_size] = dense_index;
+            }
+
+            std::vector<std::unique_ptr<std::array<size_t, sparse_page_size>>> sparse;
+            std::vector<Entity> dense;
+        };
+
+        class SparseSetBase : public EntitySet
+        {
+        public:
+            virtual ~SparseSetBase() = default;
+
+            // removes the component of the entity with the given id
+            virtual void remove(size_t id) = 0;
 
-        std::array<size_t, MAX_NUM_COMPONENT_TYPES> num_components{};
+            // change tick of every component, in the same order as entities()
+            std::vector<uint32_t> change_ticks;
+        };
 
-        std::array<std::vector<Entity>, MAX_NUM_COMPONENT_TYPES> component_type_list;
+        template<typename T>
+        class SparseSet : public SparseSetBase
+        {
+        public:
+            void insert(const Entity entity, T&& component, const uint32_t change_tick)
+            {
+                EntitySet::insert(entity);
+                data.push_back(std::move(component));
+                change_ticks.push_back(change_tick);
+            }
+
+            void remove(const size_t id) override
+            {
+                const size_t i = erase(id);
+                if (i + 1 != data.size())
+                {
+                    data[i] = std::move(data.back());
+                    change_ticks[i] = change_ticks.back();
+                }
+                data.pop_back();
+                change_ticks.pop_back();
+            }
+
+            T& get(const size_t id)
+            {
+                assert(index(id) != SIZE_MAX);
+                return data[index(id)];
+            }
+
+            const T& get(const size_t id) const
+            {
+                assert(index(id) != SIZE_MAX);
+                return data[index(id)];
+            }
+
+            std::vector<T> data;
+        };
+
+        // All entities with the same component set live in the same archetype. Every component type
+        // of an archetype is stored in its own contiguous array (SoA) and the components of one
+        // entity share the same row in all of these arrays.
+        struct Archetype
+        {
+            explicit Archetype(const Mask& archetype_mask) : mask(archetype_mask)
+            {
+                add_edges.fill(SIZE_MAX);
+                remove_edges.fill(SIZE_MAX);
+            }
+
+            template<typename T>
+            std::vector<T>& column()
+            {
+                assert(columns[type_id < T > ] != nullptr);
+                return static_cast<ComponentColumn<T>&>(*columns[type_id < T > ]).data;
+            }
+
+            template<typename T>
+            const std::vector<T>& column() const
+            {
+                assert(columns[type_id < T > ] != nullptr);
+                return static_cast<const ComponentColumn<T>&>(*columns[type_id < T > ]).data;
+            }
+
+            template<typename T>
+            void pushBack(T component, const uint32_t change_tick)
+            {
+                column<T>().push_back(std::move(component));
+                columns[type_id < T > ]->change_ticks.push_back(change_tick);
+            }
+
+            // makes room for num_rows more entities
+            void reserve(const size_t num_rows)
+            {
+                entities.reserve(entities.size() + num_rows);
+                for (auto& column : columns)
+                {
+                    if (column != nullptr)
+                    {
+                        column->reserve(entities.size() + num_rows);
+                    }
+                }
+            }
+
+            Mask mask;
+            std::vector<Entity> entities;
+            std::array<std::unique_ptr<ComponentColumnBase>, MAX_NUM_COMPONENT_TYPES> columns;
+            // cached archetype indices for adding or removing a single component type
+            std::array<size_t, MAX_NUM_COMPONENT_TYPES> add_edges{};
+            std::array<size_t, MAX_NUM_COMPONENT_TYPES> remove_edges{};
+        };
+
+        struct EntityLocation
+        {
+            size_t archetype = SIZE_MAX;
+            size_t row = SIZE_MAX;
+        };
+
+        static constexpr size_t empty_archetype_index = 0;
+
+        std::vector<std::unique_ptr<Archetype>> archetypes;
+
+        std::unordered_map<Mask, size_t> archetype_indices;
+
+        std::array<std::unique_ptr<ComponentColumnBase>, MAX_NUM_COMPONENT_TYPES> column_prototypes;
+
+        std::vector<std::bitset<MAX_NUM_COMPONENT_TYPES>> has_mask;
+
+        std::vector<EntityLocation> entity_locations;
 
         std::vector<size_t> unused_ids;
 
-        template<typename... Targs>
-        [[nodiscard]] size_t getRarestComponentId() const
-        {
-            return std::min({type_id < Targs > ...}, [&](auto a, auto b)
+        // Number of unused ids that reserveEntity() hasn't handed out yet. Equals unused_ids.size() if no entity
+        // is reserved, below 0 if new ids have been reserved.
+        std::atomic<int64_t> free_cursor = 0;
+
+        // version of the entity that currently has (or last had) an index
+        std::vector<uint32_t> versions;
+
+        // the command buffer uses the highest index bit for placeholder entities
+        static constexpr size_t max_num_entities = size_t(1) << 31;
+
+        std::array<std::unique_ptr<SparseSetBase>, MAX_NUM_COMPONENT_TYPES> sparse_sets;
+
+        thread_pool::ThreadPool* worker_pool = nullptr;
+
+        mutable std::atomic<size_t> num_active_parallel_runs = 0;
+
+        [[nodiscard]] thread_pool::ThreadPool& getThreadPool() const
+        {
+            return worker_pool == nullptr ? thread_pool::ThreadPool::getDefault() : *worker_pool;
+        }
+
+        // component types that are stored in sparse sets
+        Mask sparse_set_mask;
+
+        uint32_t change_tick = 1;
+
+        // compares with wrap around, consumers have to look at least every 2^31 ticks
+        static bool isNewer(const uint32_t tick, const uint32_t since)
+        {
+            return static_cast<int32_t>(tick - since) > 0;
+        }
+
+        uint32_t& changeTick(const size_t type, const Entity entity)
+        {
+            if (sparse_set_mask.test(type + 1))
+            {
+                SparseSetBase& sparse_set = *sparse_sets[type];
+                return sparse_set.change_ticks[sparse_set.index(entity.m_index)];
+            }
+            const EntityLocation& location = entity_locations[entity.m_index];
+            return archetypes[location.archetype]->columns[type]->change_ticks[location.row];
+        }
+
+        [[nodiscard]] uint32_t changeTick(const size_t type, const Entity entity) const
+        {
+            if (sparse_set_mask.test(type + 1))
+            {
+                const SparseSetBase& sparse_set = *sparse_sets[type];
+                return sparse_set.change_ticks[sparse_set.index(entity.m_index)];
+            }
+            const EntityLocation& location = entity_locations[entity.m_index];
+            return archetypes[location.archetype]->columns[type]->change_ticks[location.row];
+        }
+
+        // Queries without sparse set components cache the indices of the matching archetypes. These only change
+        // when a new archetype is created. Queries with sparse set components cache the matching entities.
+        struct QueryCache
+        {
+            Mask mask;
+            std::vector<size_t> archetypes;
+            EntitySet entities;
+        };
+
+        std::vector<std::unique_ptr<QueryCache>> archetype_query_caches;
+
+        std::vector<std::unique_ptr<QueryCache>> sparse_query_caches;
+
+        std::unordered_map<Mask, QueryCache*> query_caches;
+
+        std::mutex query_cache_mutex;
+
+        class SharedValuesBase
+        {
+        public:
+            virtual ~SharedValuesBase() = default;
+        };
+
+        // values that are handed out by share(), expired values are replaced on the next share() with their key
+        template<typename T>
+        class SharedValues : public SharedValuesBase
+        {
+        public:
+            std::unordered_map<std::string, std::weak_ptr<const T>> values;
+        };
+
+        // indexed by type_id<Shared<T>>
+        std::unordered_map<size_t, std::unique_ptr<SharedValuesBase>> shared_values;
+
+        std::mutex shared_values_mutex;
+
+        template<typename... Targs>
+        QueryCache& getQueryCache()
+        {
+            const Mask& mask = queryMask<Targs...>();
+            std::lock_guard<std::mutex> lock(query_cache_mutex);
+            const auto it = query_caches.find(mask);
+            if (it != query_caches.end())
+            {
+                return *it->second;
+            }
+
+            auto cache = std::make_unique<QueryCache>();
+            cache->mask = mask;
+            QueryCache& ret = *cache;
+            if constexpr (uses_sparse_sets<Targs...>)
+            {
+                for (const Entity entity : Iterator<Targs...>(*this))
+                {
+                    cache->entities.insert(entity);
+                }
+                sparse_query_caches.push_back(std::move(cache));
+            }
+            else
+            {
+                for (size_t index = 0; index < archetypes.size(); ++index)
+                {
+                    if ((archetypes[index]->mask & mask) == mask)
+                    {
+                        cache->archetypes.push_back(index);
+                    }
+                }
+                archetype_query_caches.push_back(std::move(cache));
+            }
+            query_caches[mask] = &ret;
+            return ret;
+        }
+
+        // has to be called after the components of added_mask have been added to entity
+        void addToQueryCaches(const Entity entity, const Mask& added_mask)
+        {
+            for (const auto& cache : sparse_query_caches)
+            {
+                if ((cache->mask & added_mask).any() && (has_mask[entity.m_index] & cache->mask) == cache->mask)
+                {
+                    cache->entities.insert(entity);
+                }
+            }
+        }
+
+        // has to be called before the components of removed_mask are removed from entity
+        void removeFromQueryCaches(const Entity entity, const Mask& removed_mask)
+        {
+            for (const auto& cache : sparse_query_caches)
+            {
+                if ((cache->mask & removed_mask).any() && (has_mask[entity.m_index] & cache->mask) == cache->mask)
+                {
+                    cache->entities.erase(entity.m_index);
+                }
+            }
+        }
+
+        template<typename T>
+        T& component(const Entity entity)
+        {
+            if constexpr (SparseSetStorage<T>::value)
+            {
+                return static_cast<SparseSet<T>&>(*sparse_sets[type_id < T > ]).get(entity.m_index);
+            }
+            else
+            {
+                const EntityLocation& location = entity_locations[entity.m_index];
+                assert(archetypes[location.archetype]->template column<T>().size() > location.row);
+                return archetypes[location.archetype]->template column<T>()[location.row];
+            }
+        }
+
+        template<typename T>
+        const T& component(const Entity entity) const
+        {
+            if constexpr (SparseSetStorage<T>::value)
+            {
+                return static_cast<const SparseSet<T>&>(*sparse_sets[type_id < T > ]).get(entity.m_index);
+            }
+            else
+            {
+                const EntityLocation& location = entity_locations[entity.m_index];
+                assert(archetypes[location.archetype]->template column<T>().size() > location.row);
+                return archetypes[location.archetype]->template column<T>()[location.row];
+            }
+        }
+
+        // creates the sparse set or the column prototype of T if it doesn't exist yet
+        template<typename T>
+        void registerComponentType()
+        {
+            if constexpr (SparseSetStorage<T>::value)
+            {
+                if (sparse_sets[type_id < T > ] == nullptr)
+                {
+                    sparse_sets[type_id < T > ] = std::make_unique<SparseSet<T>>();
+                    sparse_set_mask |= bit_id<T>;
+                }
+            }
+            else
+            {
+                if (column_prototypes[type_id < T > ] == nullptr)
+                {
+                    column_prototypes[type_id < T > ] = std::make_unique<ComponentColumn<T>>();
+                }
+            }
+        }
+
+        void reserveEntities(const size_t num_entities)
+        {
+            const size_t num_new_ids = num_entities > unused_ids.size() ? num_entities - unused_ids.size() : 0;
+            has_mask.reserve(has_mask.size() + num_new_ids);
+            entity_locations.reserve(entity_locations.size() + num_new_ids);
+            versions.reserve(versions.size() + num_new_ids);
+            archetypes[empty_archetype_index]->entities.reserve(archetypes[empty_archetype_index]->entities.size() + num_entities);
+        }
+
+        template<typename... Targs>
+        static constexpr bool uses_sparse_sets = (SparseSetStorage<Targs>::value || ...);
+
+        // Queries that contain sparse set components are driven by the smallest of these sparse sets.
+        // Returns nullptr if one of the sparse sets doesn't exist yet, i.e. no entity can match.
+        template<typename... Targs>
+        [[nodiscard]] const EntitySet* getSmallestSparseSet() const
+        {
+            const EntitySet* smallest = nullptr;
+            bool missing = false;
+            ([&]
+            {
+                if constexpr (SparseSetStorage<Targs>::value)
+                {
+                    const SparseSetBase* sparse_set = sparse_sets[type_id < Targs > ].get();
+                    if (sparse_set == nullptr)
+                    {
+                        missing = true;
+                    }
+                    else if (smallest == nullptr || sparse_set->entities().size() < smallest->entities().size())
+                    {
+                        smallest = sparse_set;
+                    }
+                }
+            }(), ...);
+            return missing ? nullptr : smallest;
+        }
+
+        Entity addToEmptyArchetype(const size_t id)
+        {
+            assert(!(id >= has_mask.size()) && has_mask[id].test(0));
+            const Entity entity(static_cast<uint32_t>(id), versions[id]);
+            Archetype& empty_archetype = *archetypes[empty_archetype_index];
+            empty_archetype.entities.push_back(entity);
+            entity_locations[id] = {empty_archetype_index, empty_archetype.entities.size() - 1};
+            return entity;
+        }
+
+        size_t getArchetype(const Mask& mask)
+        {
+            const auto it = archetype_indices.find(mask);
+            if (it != archetype_indices.end())
+            {
+                return it->second;
+            }
+
+            auto archetype = std::make_unique<Archetype>(mask);
+            for (size_t id = 0; id + 1 < MAX_NUM_COMPONENT_TYPES; ++id)
+            {
+                if (mask.test(id + 1))
+                {
+                    assert(column_prototypes[id] != nullptr);
+                    archetype->columns[id] = column_prototypes[id]->createEmpty();
+                }
+            }
+            archetypes.push_back(std::move(archetype));
+            archetype_indices[mask] = archetypes.size() - 1;
+            for (const auto& cache : archetype_query_caches)
+            {
+                if ((mask & cache->mask) == cache->mask)
+                {
+                    cache->archetypes.push_back(archetypes.size() - 1);
+                }
+            }
+            return archetypes.size() - 1;
+        }
+
+        template<typename T>
+        size_t getAddEdge(const size_t from_archetype)
+        {
+            size_t& edge = archetypes[from_archetype]->add_edges[type_id < T > ];
+            if (edge == SIZE_MAX)
+            {
+                edge = getArchetype(archetypes[from_archetype]->mask | bit_id<T>);
+            }
+            return edge;
+        }
+
+        template<typename T>
+        size_t getRemoveEdge(const size_t from_archetype)
+        {
+            size_t& edge = archetypes[from_archetype]->remove_edges[type_id < T > ];
+            if (edge == SIZE_MAX)
+            {
+                edge = getArchetype(archetypes[from_archetype]->mask & ~bit_id<T>);
+            }
+            return edge;
+        }
+
+        void removeRow(const size_t archetype_index, const size_t row)
+        {
+            Archetype& archetype = *archetypes[archetype_index];
+            assert(row < archetype.entities.size());
+            for (auto& column : archetype.columns)
+            {
+                if (column != nullptr)
+                {
+                    column->swapAndPop(row);
+                }
+            }
+            archetype.entities[row] = archetype.entities.back();
+            archetype.entities.pop_back();
+            if (row < archetype.entities.size())
+            {
+                entity_locations[archetype.entities[row].m_index].row = row;
+            }
+        }
+
+        // Moves all components of entity that also exist in the target archetype.
+        // The remaining components are destroyed.
+        void moveEntity(const Entity entity, const size_t to_archetype)
+        {
+            const EntityLocation from = entity_locations[entity.m_index];
+            Archetype& from_archetype = *archetypes[from.archetype];
+            Archetype& target_archetype = *archetypes[to_archetype];
+            for (size_t id = 0; id < MAX_NUM_COMPONENT_TYPES; ++id)
+            {
+                if (from_archetype.columns[id] != nullptr && target_archetype.columns[id] != nullptr)
+                {
+                    target_archetype.columns[id]->pushBackFrom(*from_archetype.columns[id], from.row);
+                }
+            }
+            target_archetype.entities.push_back(entity);
+            removeRow(from.archetype, from.row);
+            entity_locations[entity.m_index] = {to_archetype, target_archetype.entities.size() - 1};
+        }
+
+        template<typename... Targs>
+        class Iterator
+        {
+        private:
+
+            const EntityManager* m_entity_manager;
+            // if set, only the archetypes or entities of this cache are visited and m_archetype is a position in
+            // m_cache->archetypes
+            const QueryCache* m_cache = nullptr;
+            // only used if Targs... contains sparse set components, then m_row is the position in this set
+            const EntitySet* m_sparse_set = nullptr;
+            size_t m_archetype = 0;
+            size_t m_row = 0;
+
+            [[nodiscard]] size_t sparseSetSize() const
+            {
+                return m_sparse_set == nullptr ? 0 : m_sparse_set->entities().size();
+            }
+
+            [[nodiscard]] size_t numArchetypes() const
+            {
+                return m_cache == nullptr ? m_entity_manager->archetypes.size() : m_cache->archetypes.size();
+            }
+
+            [[nodiscard]] const Archetype& archetype(const size_t i) const
+            {
+                return *m_entity_manager->archetypes[m_cache == nullptr ? i : m_cache->archetypes[i]];
+            }
+
+            void skipToValidRow()
+            {
+                if constexpr (uses_sparse_sets<Targs...>)
+                {
+                    while (
+                        m_cache == nullptr && m_row < sparseSetSize() &&
+                        !matchesQuery<Targs...>(m_entity_manager->has_mask[m_sparse_set->entities()[m_row].m_index])
+                        )
+                    {
+                        m_row += 1;
+                    }
+                }
+                else
+                {
+                    while (m_archetype < numArchetypes())
+                    {
+                        const Archetype& current = archetype(m_archetype);
+                        if (m_row < current.entities.size() && matchesQuery<Targs...>(current.mask))
+                        {
+                            if constexpr (!excludes_sparse_sets<Targs...>)
+                            {
+                                break;
+                            }
+                            else if (matchesQuery<Targs...>(m_entity_manager->has_mask[current.entities[m_row].m_index]))
+                            {
+                                break;
+                            }
+                            m_row += 1;
+                            continue;
+                        }
+                        m_archetype += 1;
+                        m_row = 0;
+                    }
+                    if (m_archetype >= numArchetypes())
+                    {
+                        m_archetype = numArchetypes();
+                        m_row = 0;
+                    }
+                }
+            }
+
+            Iterator(
+                const EntityManager& entity_manager, const QueryCache* cache, const EntitySet* sparse_set,
+                const size_t archetype, const size_t row
+            ) :
+                m_entity_manager(&entity_manager), m_cache(cache), m_sparse_set(sparse_set), m_archetype(archetype), m_row(row)
+            {}
+
+        public:
+
+            explicit Iterator(const EntityManager& entity_manager, const QueryCache* cache = nullptr) :
+                m_entity_manager(&entity_manager), m_cache(cache)
+            {
+                if constexpr (uses_sparse_sets<Targs...>)
+                {
+                    m_sparse_set = cache == nullptr ? entity_manager.getSmallestSparseSet<Targs...>() : &cache->entities;
+                }
+            }
+
+            Iterator(const EntityManager& entity_manager, const Entity& entity) : Iterator(entity_manager)
+            {
+                if constexpr (uses_sparse_sets<Targs...>)
+                {
+                    m_row = m_sparse_set == nullptr ? 0 : std::min(m_sparse_set->index(entity.m_index), sparseSetSize());
+                }
+                else if (entity_manager.hasEntity(entity))
+                {
+                    m_archetype = entity_manager.entity_locations[entity.m_index].archetype;
+                    m_row = entity_manager.entity_locations[entity.m_index].row;
+                }
+                else
+                {
+                    m_archetype = entity_manager.archetypes.size();
+                }
+            }
+
+            Iterator<Targs...> begin()
+            {
+                Iterator<Targs...> ret = *this;
+                ret.skipToValidRow();
+                return ret;
+            }
+
+            [[nodiscard]] Iterator<Targs...> end() const
+            {
+                if constexpr (uses_sparse_sets<Targs...>)
+                {
+                    return Iterator<Targs...>(*m_entity_manager, m_cache, m_sparse_set, 0, sparseSetSize());
+                }
+                else
+                {
+                    return Iterator<Targs...>(*m_entity_manager, m_cache, nullptr, numArchetypes(), 0);
+                }
+            }
+
+            bool operator==(const Iterator<Targs...>& a) const
+            {
+                return this->m_archetype == a.m_archetype && this->m_row == a.m_row;
+            }
+
+            bool operator!=(const Iterator<Targs...>& a) const
+            {
+                return !(*this == a);
+            }
+
+            Entity operator*() const
+            {
+                if constexpr (uses_sparse_sets<Targs...>)
+                {
+                    return m_sparse_set->entities()[m_row];
+                }
+                else
+                {
+                    return archetype(m_archetype).entities[m_row];
+                }
+            }
+
+            Iterator<Targs...> operator++() // Prefix Increment
             {
-                return num_components[a] < num_components[b];
-            });
-        }
+                m_row += 1;
+                skipToValidRow();
+                return *this;
+            }
+        };
 
-        template<typename... Targs>
-        class Iterator
+        template<typename C, typename... Targs>
+        class Each
         {
         private:
+            C& em;
+            const QueryCache* cache;
+            std::vector<size_t> changed_types;
+            uint32_t changed_since = 0;
 
-            const EntityManager* m_entity_manager;
-            Entity m_current_entity;
-            size_t i = 0;
-            const size_t rarest_component_id = m_entity_manager->getRarestComponentId<Targs...>();
-            const Entity end_entity = Entity(m_entity_manager->has_mask.size());
+            using ArchetypeRef = std::conditional_t<std::is_const_v<C>, const Archetype&, Archetype&>;
+
+            template<typename T>
+            static constexpr bool is_queried = (std::is_same_v<T, Targs> || ...);
 
-            Entity nextValidEntity()
+            template<typename T>
+            using Component = std::conditional_t<
+                std::is_const_v<C>, const typename QueryTerm<T>::Component, typename QueryTerm<T>::Component
+            >;
+
+            // calls g for every archetype that matches Targs...
+            template<typename G>
+            void forEachArchetype(G g) const
             {
-                for (; i < m_entity_manager->component_type_list[rarest_component_id].size(); ++i)
+                if (cache != nullptr)
                 {
-                    auto tmp_entity = m_entity_manager->component_type_list[rarest_component_id][i];
-                    if (
-                        m_current_entity.m_id <= tmp_entity.m_id &&
-                        m_entity_manager->has<Targs...>(tmp_entity)
-                        )
+                    for (const size_t index : cache->archetypes)
+                    {
+                        g(*em.archetypes[index]);
+                    }
+                    return;
+                }
+                for (const auto& archetype : em.archetypes)
+                {
+                    if (matchesQuery<Targs...>(archetype->mask))
                     {
-                        return tmp_entity;
+                        g(*archetype);
                     }
                 }
-                return end_entity;
             }
 
-        public:
+            [[nodiscard]] const EntitySet* entitySet() const
+            {
+                return cache == nullptr ? em.template getSmallestSparseSet<Targs...>() : &cache->entities;
+            }
 
-            explicit Iterator(const EntityManager& entity_manager) : m_entity_manager(&entity_manager), m_current_entity(0)
-            {}
+            [[nodiscard]] bool matches(const Entity entity) const
+            {
+                return cache != nullptr || matchesQuery<Targs...>(em.has_mask[entity.m_index]);
+            }
 
-            Iterator(const EntityManager& entity_manager, const Entity& entity) : m_entity_manager(&entity_manager), m_current_entity(entity)
-            {}
+            // column of T in archetype, nullptr for excluded types, sparse set components and optional components
+            // that archetype doesn't have
+            template<typename T>
+            static Component<T>* columnData(ArchetypeRef archetype)
+            {
+                using Type = typename QueryTerm<T>::Component;
+                if constexpr (QueryTerm<T>::excluded || SparseSetStorage<Type>::value)
+                {
+                    return nullptr;
+                }
+                else if constexpr (QueryTerm<T>::optional)
+                {
+                    return (archetype.mask & bit_id<Type>).none() ? nullptr : archetype.template column<Type>().data();
+                }
+                else
+                {
+                    return archetype.template column<Type>().data();
+                }
+            }
 
-            Iterator<Targs...> begin()
+            // The arguments f gets for T: a reference for required components, a pointer that is nullptr if the
+            // entity doesn't have the component for Optional<T> and nothing for Without<T>.
+            template<typename T>
+            auto arguments(const Entity entity) const
             {
-                return Iterator<Targs...>(*m_entity_manager, nextValidEntity());
+                using Type = typename QueryTerm<T>::Component;
+                if constexpr (QueryTerm<T>::excluded)
+                {
+                    return std::tuple<>();
+                }
+                else if constexpr (QueryTerm<T>::optional)
+                {
+                    return std::tuple<Component<T>*>(
+                        (em.has_mask[entity.m_index] & bit_id<Type>).none() ? nullptr : &em.template component<Type>(entity)
+                    );
+                }
+                else
+                {
+                    return std::tuple<Component<T>&>(em.template component<Type>(entity));
+                }
             }
 
-            [[nodiscard]] Iterator<Targs...> end() const
+            // same as arguments(entity) but takes archetype components from column
+            template<typename T>
+            auto arguments(const Entity entity, Component<T>* column, const size_t row) const
             {
-                return Iterator<Targs...>(*m_entity_manager, end_entity);
+                if constexpr (QueryTerm<T>::excluded || SparseSetStorage<typename QueryTerm<T>::Component>::value)
+                {
+                    return arguments<T>(entity);
+                }
+                else if constexpr (QueryTerm<T>::optional)
+                {
+                    return std::tuple<Component<T>*>(column == nullptr ? nullptr : column + row);
+                }
+                else
+                {
+                    return std::tuple<Component<T>&>(column[row]);
+                }
             }
 
-            bool operator==(const Iterator<Targs...>& a) const
+            [[nodiscard]] bool changed(const Archetype& archetype, const size_t row) const
+            {
+                for (const size_t type : changed_types)
+                {
+                    const auto& column = archetype.columns[type];
+                    const uint32_t tick = column != nullptr ? column->change_ticks[row] : em.changeTick(type, archetype.entities[row]);
+                    if (isNewer(tick, changed_since))
+                    {
+                        return true;
+                    }
+                }
+                return changed_types.empty();
+            }
+
+            [[nodiscard]] bool changed(const Entity entity) const
             {
-                return this->m_current_entity == a.m_current_entity;
+                for (const size_t type : changed_types)
+                {
+                    if (isNewer(em.changeTick(type, entity), changed_since))
+                    {
+                        return true;
+                    }
+                }
+                return changed_types.empty();
             }
 
-            bool operator!=(const Iterator<Targs...>& a) const
+            // f may take the entity as first parameter
+            template<typename F, typename... Components>
+            static void call(F& f, const Entity entity, Components& ... components)
             {
-                return !(*this == a);
+                if constexpr (std::is_invocable_v<F&, Entity, Components& ...>)
+                {
+                    f(entity, components...);
+                }
+                else
+                {
+                    f(components...);
+                }
             }
 
-            Entity operator*() const
+            template<typename F, typename Arguments>
+            static void callWith(F& f, const Entity entity, Arguments arguments)
             {
-                return m_current_entity;
+                std::apply([&](auto& ... components)
+                           { call(f, entity, components...); }, arguments);
             }
 
-            Iterator<Targs...> operator++() // Prefix Increment
+            template<typename F>
+            void runRows(F& f, ArchetypeRef archetype, const size_t begin, const size_t end) const
             {
-                m_current_entity.m_id += 1;
-                i += 1;
-                m_current_entity = nextValidEntity();
-                return *this;
+                const bool filter_changed = !changed_types.empty();
+                [&](auto* ... columns)
+                {
+                    for (size_t row = begin; row < end; ++row)
+                    {
+                        const Entity entity = archetype.entities[row];
+                        if constexpr (excludes_sparse_sets<Targs...>)
+                        {
+                            if (!matchesQuery<Targs...>(em.has_mask[entity.m_index]))
+                            {
+                                continue;
+                            }
+                        }
+                        if (!filter_changed || changed(archetype, row))
+                        {
+                            callWith(f, entity, std::tuple_cat(arguments<Targs>(entity, columns, row)...));
+                        }
+                    }
+                }(columnData<Targs>(archetype)...);
+            }
+
+            template<typename F>
+            void runImpl(F& f) const
+            {
+                if constexpr (uses_sparse_sets<Targs...>)
+                {
+                    const EntitySet* entity_set = entitySet();
+                    if (entity_set == nullptr)
+                    {
+                        return;
+                    }
+                    for (const Entity entity : entity_set->entities())
+                    {
+                        if (matches(entity) && changed(entity))
+                        {
+                            callWith(f, entity, std::tuple_cat(arguments<Targs>(entity)...));
+                        }
+                    }
+                }
+                else
+                {
+                    forEachArchetype([&](ArchetypeRef archetype)
+                    {
+                        runRows(f, archetype, 0, archetype.entities.size());
+                    });
+                }
+            }
+
+            template<typename F>
+            void parallelRunImpl(F& f, const size_t grain) const
+            {
+                struct ParallelRunGuard
+                {
+                    explicit ParallelRunGuard(C& entity_manager) : guarded_em(entity_manager)
+                    {
+                        guarded_em.num_active_parallel_runs += 1;
+                    }
+
+                    ~ParallelRunGuard()
+                    {
+                        guarded_em.num_active_parallel_runs -= 1;
+                    }
+
+                    C& guarded_em;
+                } guard(em);
+
+                if constexpr (uses_sparse_sets<Targs...>)
+                {
+                    const EntitySet* entity_set = entitySet();
+                    if (entity_set == nullptr)
+                    {
+                        return;
+                    }
+                    const auto& entities = entity_set->entities();
+                    em.getThreadPool().parallelFor(entities.size(), grain, [&](const size_t begin, const size_t end)
+                    {
+                        for (size_t i = begin; i < end; ++i)
+                        {
+                            if (matches(entities[i]) && changed(entities[i]))
+                            {
+                                callWith(f, entities[i], std::tuple_cat(arguments<Targs>(entities[i])...));
+                            }
+                        }
+                    });
+                }
+                else
+                {
+                    parallelForEachRange(grain, [&](ArchetypeRef archetype, const size_t begin, const size_t end)
+                    {
+                        runRows(f, archetype, begin, end);
+                    });
+                }
+            }
+
+            // splits the rows of the matching archetypes into ranges of at most grain rows and calls
+            // g(archetype, begin, end) for every range on the thread pool
+            template<typename G>
+            void parallelForEachRange(const size_t grain, G g) const
+            {
+                struct Range
+                {
+                    std::remove_reference_t<ArchetypeRef>* archetype;
+                    size_t begin;
+                    size_t end;
+                };
+                std::vector<Range> ranges;
+                const size_t range_size = std::max<size_t>(grain, 1);
+                forEachArchetype([&](ArchetypeRef archetype)
+                {
+                    for (size_t begin = 0; begin < archetype.entities.size(); begin += range_size)
+                    {
+                        ranges.push_back({&archetype, begin, std::min(archetype.entities.size(), begin + range_size)});
+                    }
+                });
+                em.getThreadPool().parallelFor(ranges.size(), 1, [&](const size_t begin, const size_t end)
+                {
+                    for (size_t i = begin; i < end; ++i)
+                    {
+                        g(*ranges[i].archetype, ranges[i].begin, ranges[i].end);
+                    }
+                });
+            }
+
+            template<typename F>
+            void parallelRunBatchesImpl(F& f, const size_t grain) const
+            {
+                static_assert(
+                    !uses_sparse_sets<Targs...> && !has_filters<Targs...>,
+                    "Batches are only supported for archetype components without filters."
+                );
+                assert(changed_types.empty() && "Batches can't be filtered by changes.");
+                struct ParallelRunGuard
+                {
+                    explicit ParallelRunGuard(C& entity_manager) : guarded_em(entity_manager)
+                    {
+                        guarded_em.num_active_parallel_runs += 1;
+                    }
+
+                    ~ParallelRunGuard()
+                    {
+                        guarded_em.num_active_parallel_runs -= 1;
+                    }
+
+                    C& guarded_em;
+                } guard(em);
+
+                parallelForEachRange(grain, [&](ArchetypeRef archetype, const size_t begin, const size_t end)
+                {
+                    f(
+                        std::span<const Entity>(archetype.entities.data() + begin, end - begin),
+                        std::span<Component<Targs>>(archetype.template column<Targs>().data() + begin, end - begin)...
+                    );
+                });
             }
-        };
 
-        template<typename C, typename... Targs>
-        class Each
-        {
-        private:
-            C& em;
         public:
-            explicit Each(C& entity_manager) : em(entity_manager)
+            explicit Each(C& entity_manager, const QueryCache* query_cache = nullptr) :
+                em(entity_manager), cache(query_cache)
             {}
 
             Each(const Each&) = delete;
 
             void operator=(const Each&) = delete;
 
+            // Only visits entities for which at least one of Tchanged... has been created or marked as changed after
+            // the change tick since.
+            template<typename... Tchanged>
+            Each& changedSince(const uint32_t since)
+            {
+                static_assert((is_queried<Tchanged> && ...), "Only queried component types can be checked for changes.");
+                changed_types = {type_id<Tchanged>...};
+                changed_since = since;
+                return *this;
+            }
+
             template<typename F>
             void run(F f)
             {
-                for (auto entity : em.template iterator<Targs...>())
-                {
-                    f(em.template get<Targs>(entity)...);
-                }
+                runImpl(f);
             }
 
             template<typename F>
             void run(F f) const
             {
-                for (auto entity : em.template iterator<Targs...>())
+                runImpl(f);
+            }
+
+            // Like run() but splits the matching entities into ranges of grain entities that are processed
+            // by the thread pool of the entity manager. Every entity is visited by exactly one thread, so f
+            // may write to the components it gets passed, but it must not access components of other
+            // entities mutably and must not create or remove entities or components. Like in run(), f may take
+            // the visited entity as first parameter, e.g. to call markChanged() for it.
+            template<typename F>
+            void parallelRun(F f, const size_t grain = 256)
+            {
+                parallelRunImpl(f, grain);
+            }
+
+            template<typename F>
+            void parallelRun(F f, const size_t grain = 256) const
+            {
+                parallelRunImpl(f, grain);
+            }
+
+            // Like parallelRun() but f gets up to grain consecutive entities of one archetype at once as spans,
+            // e.g. for kernels that process many components together:
+            //     f(std::span<const Entity> entities, std::span<T1> c1, std::span<T2> c2, ...)
+            template<typename F>
+            void parallelRunBatches(F f, const size_t grain = 4096)
+            {
+                parallelRunBatchesImpl(f, grain);
+            }
+
+            template<typename F>
+            void parallelRunBatches(F f, const size_t grain = 4096) const
+            {
+                parallelRunBatchesImpl(f, grain);
+            }
+        };
+
+
+        template<typename... Targs>
+        class View
+        {
+        public:
+
+            class ViewIterator
+            {
+            public:
+
+                std::tuple<Targs& ...> operator*() const
+                {
+                    if constexpr (uses_sparse_sets<Targs...>)
+                    {
+                        const Entity entity = m_view->m_cache->entities.entities()[m_row];
+                        return {m_view->m_entity_manager->template component<Targs>(entity)...};
+                    }
+                    else
+                    {
+                        return std::apply([this](auto* ... columns)
+                                          { return std::tuple<Targs& ...>{columns[m_row]...}; }, m_columns);
+                    }
+                }
+
+                ViewIterator& operator++()
+                {
+                    m_row += 1;
+                    skipToValidRow();
+                    return *this;
+                }
+
+                bool operator==(const ViewIterator& a) const
+                {
+                    return m_archetype == a.m_archetype && m_row == a.m_row;
+                }
+
+                bool operator!=(const ViewIterator& a) const
+                {
+                    return !(*this == a);
+                }
+
+            private:
+
+                friend class View;
+
+                const View* m_view;
+                size_t m_archetype;
+                size_t m_row;
+                // only used if Targs... doesn't contain sparse set components
+                std::tuple<Targs* ...> m_columns{};
+                size_t m_num_rows = 0;
+
+                ViewIterator(const View& view, const size_t archetype, const size_t row) :
+                    m_view(&view), m_archetype(archetype), m_row(row)
+                {
+                    loadArchetype();
+                }
+
+                void loadArchetype()
+                {
+                    if constexpr (!uses_sparse_sets<Targs...>)
+                    {
+                        const auto& archetypes = m_view->m_cache->archetypes;
+                        if (m_archetype < archetypes.size())
+                        {
+                            Archetype& archetype = *m_view->m_entity_manager->archetypes[archetypes[m_archetype]];
+                            m_columns = {archetype.template column<Targs>().data()...};
+                            m_num_rows = archetype.entities.size();
+                        }
+                    }
+                }
+
+                void skipToValidRow()
+                {
+                    if constexpr (!uses_sparse_sets<Targs...>)
+                    {
+                        const size_t num_archetypes = m_view->m_cache->archetypes.size();
+                        while (m_archetype < num_archetypes && m_row >= m_num_rows)
+                        {
+                            m_archetype += 1;
+                            m_row = 0;
+                            loadArchetype();
+                        }
+                    }
+                }
+            };
+
+            ViewIterator begin() const
+            {
+                ViewIterator ret(*this, 0, 0);
+                ret.skipToValidRow();
+                return ret;
+            }
+
+            [[nodiscard]] ViewIterator end() const
+            {
+                if constexpr (uses_sparse_sets<Targs...>)
+                {
+                    return ViewIterator(*this, 0, m_cache->entities.entities().size());
+                }
+                else
                 {
-                    f(em.template get<Targs>(entity)...);
+                    return ViewIterator(*this, m_cache->archetypes.size(), 0);
                 }
             }
+
+        private:
+
+            friend class EntityManager;
+
+            EntityManager* m_entity_manager;
+            const QueryCache* m_cache;
+
+            View(EntityManager& entity_manager, const QueryCache& cache) :
+                m_entity_manager(&entity_manager), m_cache(&cache)
+            {}
+        };
+
+    public:
+
+        template<typename... Targs>
+        class Query
+        {
+            friend class EntityManager;
+
+        public:
+
+            [[nodiscard]] Iterator<Targs...> begin() const
+            {
+                return Iterator<Targs...>(*m_entity_manager, m_cache).begin();
+            }
+
+            [[nodiscard]] Iterator<Targs...> end() const
+            {
+                return Iterator<Targs...>(*m_entity_manager, m_cache).end();
+            }
+
+            [[nodiscard]] Each<EntityManager, Targs...> each() const
+            {
+                return Each<EntityManager, Targs...>(*m_entity_manager, m_cache);
+            }
+
+            [[nodiscard]] View<Targs...> view() const
+            {
+                return View<Targs...>(*m_entity_manager, *m_cache);
+            }
+
+        private:
+
+            Query(EntityManager& entity_manager, const QueryCache& cache) :
+                m_entity_manager(&entity_manager), m_cache(&cache)
+            {}
+
+            EntityManager* m_entity_manager;
+            const QueryCache* m_cache;
         };
     };
 
@@ -472,19 +2186,4 @@ namespace ec_system
         return hasEntity(entity);
     }
 
-    template<>
-    inline Entity EntityManager::Iterator<void>::nextValidEntity()
-    {
-        Entity next = m_current_entity;
-        while (end().m_current_entity.m_id > next.m_id)
-        {
-            if (m_entity_manager->has<void>(next))
-            {
-                return next;
-            }
-            next.m_id += 1;
-        }
-        return end().m_current_entity;
-    }
-
 }
@@ -0,0 +1,378 @@
+#pragma once
+
+#include "ec_system.hpp"
+#include <vector>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <algorithm>
+
+namespace ec_system
+{
+    // Records structural changes so that they can be applied later at a sync point, e.g. when no iterator or
+    // parallelRun() is active anymore. Recording is thread safe. apply() handles all commands of an entity at
+    // once, so the entity is moved at most once, and reserves the memory of all target archetypes up front.
+    class EntityCommandBuffer
+    {
+    public:
+
+        EntityCommandBuffer() = default;
+
+        EntityCommandBuffer(const EntityCommandBuffer&) = delete;
+
+        void operator=(const EntityCommandBuffer&) = delete;
+
+        // Returns a placeholder that can only be used for commands of this buffer until apply() is called. Use
+        // EntityManager::reserveEntity() for handles that are valid outside of this buffer, too.
+        Entity createEntity()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            const Entity entity(pending_flag | static_cast<uint32_t>(m_num_pending_entities), 0);
+            m_num_pending_entities += 1;
+            return entity;
+        }
+
+        void removeEntity(const Entity entity)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_commands.push_back({Command::Type::remove_entity, entity, SIZE_MAX, 0, Mask(0)});
+        }
+
+        template<typename T, typename... Args>
+        void createComponent(const Entity entity, Args&& ... args)
+        {
+            const Mask& bit = EntityManager::bit_id<T>;
+            T component = T{std::forward<Args>(args)...};
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto& batch = m_batches[EntityManager::type_id<T>];
+            if (batch == nullptr)
+            {
+                batch = std::make_unique<ComponentBatch<T>>();
+            }
+            auto& components = static_cast<ComponentBatch<T>&>(*batch).components;
+            m_commands.push_back({Command::Type::create_component, entity, EntityManager::type_id<T>, components.size(), bit});
+            components.push_back(std::move(component));
+        }
+
+        template<typename T>
+        void removeComponent(const Entity entity)
+        {
+            const Mask& bit = EntityManager::bit_id<T>;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_commands.push_back({Command::Type::remove_component, entity, EntityManager::type_id<T>, 0, bit});
+        }
+
+        [[nodiscard]] bool empty() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_commands.empty() && m_num_pending_entities == 0;
+        }
+
+        // Applies and clears all recorded commands. The commands of one entity are applied in the order they were
+        // recorded. Returns the created entities in the order of the createEntity() calls.
+        std::vector<Entity> apply(EntityManager& entity_manager)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            assert(
+                entity_manager.num_active_parallel_runs == 0 &&
+                "Structural changes are not allowed during parallelRun()."
+            );
+            try
+            {
+                auto created_entities = applyCommands(entity_manager);
+                clear();
+                return created_entities;
+            }
+            catch (...)
+            {
+                clear();
+                throw;
+            }
+        }
+
+    private:
+
+        using Mask = std::bitset<MAX_NUM_COMPONENT_TYPES>;
+
+        static constexpr uint32_t pending_flag = uint32_t(1) << 31;
+
+        struct Command
+        {
+            enum class Type
+            {
+                remove_entity,
+                create_component,
+                remove_component
+            };
+
+            Type type;
+            Entity entity;
+            size_t component_type;
+            // position of the component in its batch
+            size_t index;
+            Mask bit;
+        };
+
+        class ComponentBatchBase
+        {
+        public:
+            virtual ~ComponentBatchBase() = default;
+
+            virtual void registerComponentType(EntityManager& entity_manager) const = 0;
+
+            // moves the component at index into the (already reserved) slot of entity
+            virtual void moveTo(EntityManager& entity_manager, Entity entity, size_t index) = 0;
+
+            virtual void clear() = 0;
+        };
+
+        template<typename T>
+        class ComponentBatch : public ComponentBatchBase
+        {
+        public:
+            void registerComponentType(EntityManager& entity_manager) const override
+            {
+                entity_manager.registerComponentType<T>();
+            }
+
+            void moveTo(EntityManager& entity_manager, const Entity entity, const size_t index) override
+            {
+                if constexpr (SparseSetStorage<T>::value)
+                {
+                    auto& sparse_set = static_cast<EntityManager::SparseSet<T>&>(
+                        *entity_manager.sparse_sets[EntityManager::type_id<T>]
+                    );
+                    if (sparse_set.contains(entity.m_index))
+                    {
+                        sparse_set.get(entity.m_index) = std::move(components[index]);
+                        sparse_set.change_ticks[sparse_set.index(entity.m_index)] = entity_manager.change_tick;
+                    }
+                    else
+                    {
+                        sparse_set.insert(entity, std::move(components[index]), entity_manager.change_tick);
+                    }
+                }
+                else
+                {
+                    const auto& location = entity_manager.entity_locations[entity.m_index];
+                    auto& archetype = *entity_manager.archetypes[location.archetype];
+                    auto& column = archetype.template column<T>();
+                    if (location.row < column.size())
+                    {
+                        // the component has been removed and created again
+                        column[location.row] = std::move(components[index]);
+                        archetype.columns[EntityManager::type_id<T>]->change_ticks[location.row] = entity_manager.change_tick;
+                    }
+                    else
+                    {
+                        assert(location.row == column.size());
+                        archetype.template pushBack<T>(std::move(components[index]), entity_manager.change_tick);
+                    }
+                }
+            }
+
+            void clear() override
+            {
+                components.clear();
+            }
+
+            std::vector<T> components;
+        };
+
+        // all commands of one entity after they have been combined
+        struct Change
+        {
+            Entity entity;
+            size_t first_command;
+            size_t end_command;
+            bool remove_entity = false;
+            Mask mask;
+            size_t archetype = SIZE_MAX;
+        };
+
+        mutable std::mutex m_mutex;
+        std::vector<Command> m_commands;
+        std::array<std::unique_ptr<ComponentBatchBase>, MAX_NUM_COMPONENT_TYPES> m_batches;
+        size_t m_num_pending_entities = 0;
+
+        void clear()
+        {
+            m_commands.clear();
+            for (auto& batch : m_batches)
+            {
+                if (batch != nullptr)
+                {
+                    batch->clear();
+                }
+            }
+            m_num_pending_entities = 0;
+        }
+
+        std::vector<Entity> applyCommands(EntityManager& entity_manager)
+        {
+            // entities from EntityManager::reserveEntity() may be used by the commands
+            entity_manager.flushReservedEntities();
+            std::vector<Entity> created_entities;
+            created_entities.reserve(m_num_pending_entities);
+            entity_manager.reserveEntities(m_num_pending_entities);
+            for (size_t i = 0; i < m_num_pending_entities; ++i)
+            {
+                created_entities.push_back(entity_manager.createEntity());
+            }
+
+            for (const auto& batch : m_batches)
+            {
+                if (batch != nullptr)
+                {
+                    batch->registerComponentType(entity_manager);
+                }
+            }
+
+            for (Command& command : m_commands)
+            {
+                if ((command.entity.m_index & pending_flag) != 0)
+                {
+                    assert((command.entity.m_index & ~pending_flag) < created_entities.size());
+                    command.entity = created_entities[command.entity.m_index & ~pending_flag];
+                }
+            }
+            std::stable_sort(
+                m_commands.begin(), m_commands.end(), [](const Command& a, const Command& b)
+                {
+                    return a.entity.m_index < b.entity.m_index;
+                }
+            );
+
+            // first pass: check the commands and find the archetype every entity ends up in
+            std::vector<Change> changes;
+            try
+            {
+                for (size_t begin = 0, end = 0; begin < m_commands.size(); begin = end)
+                {
+                    Change change;
+                    change.entity = m_commands[begin].entity;
+                    change.first_command = begin;
+                    if (!entity_manager.hasEntity(change.entity))
+                    {
+                        throw std::runtime_error(
+                            std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                            "Can't apply command. Entity doesn't exists.");
+                    }
+                    change.mask = entity_manager.has_mask[change.entity.m_index];
+                    for (end = begin; end < m_commands.size() && m_commands[end].entity == change.entity; ++end)
+                    {
+                        const Command& command = m_commands[end];
+                        if (change.remove_entity)
+                        {
+                            throw std::runtime_error(
+                                std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                                "Can't apply command. Entity has already been removed.");
+                        }
+                        switch (command.type)
+                        {
+                            case Command::Type::remove_entity:
+                                change.remove_entity = true;
+                                break;
+                            case Command::Type::create_component:
+                                if ((change.mask & command.bit).any())
+                                {
+                                    throw std::runtime_error(
+                                        std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                                        "Can't create component. Component already exists.");
+                                }
+                                change.mask |= command.bit;
+                                break;
+                            case Command::Type::remove_component:
+                                if ((change.mask & command.bit).none())
+                                {
+                                    throw std::runtime_error(
+                                        std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                                        "Can't remove component. Component doesn't exists.");
+                                }
+                                change.mask &= ~command.bit;
+                                break;
+                        }
+                    }
+                    change.end_command = end;
+                    if (!change.remove_entity)
+                    {
+                        change.archetype = entity_manager.getArchetype(change.mask & ~entity_manager.sparse_set_mask);
+                    }
+                    changes.push_back(change);
+                }
+            }
+            catch (...)
+            {
+                // nothing has been changed yet except for the created placeholders
+                for (const Entity entity : created_entities)
+                {
+                    entity_manager.removeEntity(entity);
+                }
+                throw;
+            }
+
+            std::vector<size_t> num_new_rows(entity_manager.archetypes.size(), 0);
+            for (const Change& change : changes)
+            {
+                if (!change.remove_entity && change.archetype != entity_manager.entity_locations[change.entity.m_index].archetype)
+                {
+                    num_new_rows[change.archetype] += 1;
+                }
+            }
+            for (size_t i = 0; i < num_new_rows.size(); ++i)
+            {
+                if (num_new_rows[i] > 0)
+                {
+                    entity_manager.archetypes[i]->reserve(num_new_rows[i]);
+                }
+            }
+
+            // second pass: move every entity once and fill in the new components
+            for (const Change& change : changes)
+            {
+                const Entity entity = change.entity;
+                if (change.remove_entity)
+                {
+                    entity_manager.removeEntity(entity);
+                    continue;
+                }
+
+                const Mask old_mask = entity_manager.has_mask[entity.m_index];
+                const Mask removed_mask = old_mask & ~change.mask;
+                entity_manager.removeFromQueryCaches(entity, removed_mask);
+                const Mask removed_sparse_set_components = removed_mask & entity_manager.sparse_set_mask;
+                for (size_t id = 0; removed_sparse_set_components.any() && id + 1 < MAX_NUM_COMPONENT_TYPES; ++id)
+                {
+                    if (removed_sparse_set_components.test(id + 1))
+                    {
+                        entity_manager.sparse_sets[id]->remove(entity.m_index);
+                    }
+                }
+                if (change.archetype != entity_manager.entity_locations[entity.m_index].archetype)
+                {
+                    entity_manager.moveEntity(entity, change.archetype);
+                }
+
+                // only the last created component of each type survives
+                Mask created_mask;
+                for (size_t i = change.end_command; i > change.first_command; --i)
+                {
+                    const Command& command = m_commands[i - 1];
+                    if (
+                        command.type == Command::Type::create_component &&
+                        (change.mask & command.bit).any() && (created_mask & command.bit).none()
+                        )
+                    {
+                        m_batches[command.component_type]->moveTo(entity_manager, entity, command.index);
+                        created_mask |= command.bit;
+                    }
+                }
+
+                entity_manager.has_mask[entity.m_index] = change.mask;
+                entity_manager.addToQueryCaches(entity, change.mask & ~old_mask);
+            }
+
+            return created_entities;
+        }
+    };
+}
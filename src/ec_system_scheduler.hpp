@@ -0,0 +1,190 @@
+#pragma once
+
+#include "ec_system.hpp"
+#include "ec_system_command_buffer.hpp"
+#include "thread_pool.hpp"
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+
+namespace ec_system
+{
+    template<typename... Targs>
+    struct Reads
+    {
+    };
+
+    template<typename... Targs>
+    struct Writes
+    {
+    };
+
+    // Runs all added systems once per call of run(). A system runs after every earlier added system it conflicts
+    // with, i.e. one of them writes a component type that the other one reads or writes. Systems that don't
+    // conflict may run concurrently on the thread pool. Systems that have to run on the main thread (e.g. because
+    // they use GLFW or OpenGL) are run by the thread that calls run(). Structural changes that systems record
+    // into getCommandBuffer() are applied after all systems ran.
+    class SystemScheduler
+    {
+    public:
+
+        enum class Thread
+        {
+            any,
+            main
+        };
+
+        struct Timing
+        {
+            std::string name;
+            std::chrono::microseconds duration;
+        };
+
+        explicit SystemScheduler(EntityManager& entity_manager, thread_pool::ThreadPool* pool = nullptr) :
+            m_entity_manager(entity_manager), m_pool(pool)
+        {}
+
+        SystemScheduler(const SystemScheduler&) = delete;
+
+        void operator=(const SystemScheduler&) = delete;
+
+        template<typename... R, typename... W, typename F>
+        void addSystem(std::string name, Reads<R...>, Writes<W...>, F f, const Thread thread = Thread::any)
+        {
+            System system;
+            system.name = std::move(name);
+            system.reads = EntityManager::componentMask<R...>();
+            system.writes = EntityManager::componentMask<W...>();
+            system.main_thread = thread == Thread::main;
+            system.function = std::move(f);
+
+            // a system is in the wave after the last wave that contains a system it conflicts with
+            size_t wave = 0;
+            for (const System& other : m_systems)
+            {
+                const bool conflict =
+                    (system.writes & (other.reads | other.writes)).any() ||
+                    (system.reads & other.writes).any();
+                if (conflict)
+                {
+                    wave = std::max(wave, other.wave + 1);
+                }
+            }
+            system.wave = wave;
+
+            if (m_waves.size() <= wave)
+            {
+                m_waves.resize(wave + 1);
+            }
+            if (system.main_thread)
+            {
+                m_waves[wave].main_thread_systems.push_back(m_systems.size());
+            }
+            else
+            {
+                m_waves[wave].systems.push_back(m_systems.size());
+            }
+            m_systems.push_back(std::move(system));
+        }
+
+        void run()
+        {
+            for (const Wave& wave : m_waves)
+            {
+                // systems that ran in earlier waves have changed components with older ticks
+                m_entity_manager.advanceChangeTick();
+
+                // the pool systems are queued first, so that the main thread systems of the wave overlap with them
+                m_entity_manager.num_active_parallel_runs += 1;
+                try
+                {
+                    getThreadPool().parallelFor(
+                        wave.systems.size(), 1,
+                        [&](const size_t begin, const size_t end)
+                        {
+                            for (size_t i = begin; i < end; ++i)
+                            {
+                                runSystem(m_systems[wave.systems[i]]);
+                            }
+                        },
+                        [&]
+                        {
+                            for (const size_t index : wave.main_thread_systems)
+                            {
+                                runSystem(m_systems[index]);
+                            }
+                        }
+                    );
+                }
+                catch (...)
+                {
+                    m_entity_manager.num_active_parallel_runs -= 1;
+                    throw;
+                }
+                m_entity_manager.num_active_parallel_runs -= 1;
+            }
+
+            // systems only see ticks that are newer than the tick they ran at, so the changes of the command buffer and
+            // the changes until the next call of run() get a tick after the last wave
+            m_entity_manager.advanceChangeTick();
+            m_command_buffer.apply(m_entity_manager);
+        }
+
+        EntityCommandBuffer& getCommandBuffer()
+        {
+            return m_command_buffer;
+        }
+
+        // durations of the systems during the last call of run(), in the order they were added
+        [[nodiscard]] std::vector<Timing> getTimings() const
+        {
+            std::vector<Timing> ret;
+            for (const System& system : m_systems)
+            {
+                ret.push_back({system.name, system.duration});
+            }
+            return ret;
+        }
+
+    private:
+
+        struct System
+        {
+            std::string name;
+            std::bitset<MAX_NUM_COMPONENT_TYPES> reads;
+            std::bitset<MAX_NUM_COMPONENT_TYPES> writes;
+            bool main_thread = false;
+            size_t wave = 0;
+            std::function<void()> function;
+            std::chrono::microseconds duration{0};
+        };
+
+        struct Wave
+        {
+            std::vector<size_t> systems;
+            std::vector<size_t> main_thread_systems;
+        };
+
+        EntityManager& m_entity_manager;
+        thread_pool::ThreadPool* m_pool;
+        std::vector<System> m_systems;
+        std::vector<Wave> m_waves;
+        EntityCommandBuffer m_command_buffer;
+
+        [[nodiscard]] thread_pool::ThreadPool& getThreadPool() const
+        {
+            return m_pool == nullptr ? m_entity_manager.getThreadPool() : *m_pool;
+        }
+
+        static void runSystem(System& system)
+        {
+            const auto start = std::chrono::high_resolution_clock::now();
+            system.function();
+            system.duration = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::high_resolution_clock::now() - start
+            );
+        }
+    };
+}
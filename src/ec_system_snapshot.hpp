@@ -0,0 +1,558 @@
+#pragma once
+
+#include "ec_system.hpp"
+#include <vector>
+#include <array>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <filesystem>
+#include <memory>
+#include <type_traits>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace ec_system
+{
+    // Bounds checked reading of a snapshot.
+    class SnapshotReader
+    {
+    public:
+
+        SnapshotReader(const char* begin, const char* end) : m_begin(begin), m_position(begin), m_end(end)
+        {}
+
+        template<typename T>
+        T read()
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            T value;
+            std::memcpy(&value, bytes(sizeof(T)), sizeof(T));
+            return value;
+        }
+
+        const char* bytes(const size_t size)
+        {
+            if (size > remaining())
+            {
+                throw std::runtime_error(
+                    std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                    "Can't read snapshot. Snapshot is truncated.");
+            }
+            const char* ret = m_position;
+            m_position += size;
+            return ret;
+        }
+
+        // count elements of size bytes each, checked before multiplying, so that a corrupt count can't wrap around
+        const char* bytes(const size_t count, const size_t size)
+        {
+            if (count > remaining() / size)
+            {
+                throw std::runtime_error(
+                    std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                    "Can't read snapshot. Snapshot is truncated.");
+            }
+            return bytes(count * size);
+        }
+
+        [[nodiscard]] size_t remaining() const
+        {
+            return static_cast<size_t>(m_end - m_position);
+        }
+
+        // blocks start at multiples of the block alignment, so raw component arrays can be used in place
+        void align()
+        {
+            bytes((block_alignment - (m_position - m_begin) % block_alignment) % block_alignment);
+        }
+
+        static constexpr size_t block_alignment = 16;
+
+    private:
+
+        const char* m_begin;
+        const char* m_position;
+        const char* m_end;
+    };
+
+    // Components that are trivially copyable are written as raw arrays. Every other component type needs a
+    // specialization with the members
+    //     static void write(std::vector<char>& out, const T& component);
+    //     static T read(SnapshotReader& in);
+    template<typename T>
+    struct SnapshotSerializer;
+
+    template<>
+    struct SnapshotSerializer<std::string>
+    {
+        static void write(std::vector<char>& out, const std::string& string)
+        {
+            const uint64_t size = string.size();
+            out.insert(out.end(), reinterpret_cast<const char*>(&size), reinterpret_cast<const char*>(&size) + sizeof(size));
+            out.insert(out.end(), string.begin(), string.end());
+        }
+
+        static std::string read(SnapshotReader& in)
+        {
+            const auto size = in.read<uint64_t>();
+            const char* data = in.bytes(size);
+            return std::string(data, size);
+        }
+    };
+
+    // Binary snapshot of all entities and of their components of the types Targs... Entity handles stay valid
+    // across save() and restore(). Only component types with a registered id (see EC_SYSTEM_REGISTER_COMPONENT)
+    // can be stored, because the ids are written to the file. Other component types are skipped.
+    //
+    // Layout (all blocks 16 byte aligned):
+    //     header: magic, format version, number of entity ids, number of archetype and sparse set blocks
+    //     versions of all entity ids
+    //     per archetype: component type ids, number of rows, entity ids, type id and block of every component type
+    //     per sparse set: component type id, number of entities, entity ids, component block
+    class Snapshot
+    {
+    public:
+
+        Snapshot() = delete;
+
+        static constexpr uint32_t format_version = 1;
+
+        template<typename... Targs>
+        static void save(const EntityManager& entity_manager, const std::filesystem::path& file_path)
+        {
+            static_assert(((ComponentTypeId<Targs>::value != SIZE_MAX) && ...), "Only registered component types can be saved.");
+
+            const auto& archetypes = entity_manager.archetypes;
+            const Mask saved_mask = EntityManager::componentMask<Targs...>();
+            std::vector<char> out;
+
+            write(out, magic);
+            write(out, format_version);
+            write(out, uint64_t(entity_manager.versions.size()));
+            write(out, uint64_t(archetypes.size()));
+            write(out, uint64_t(sizeof...(Targs)));
+            pad(out);
+            out.insert(
+                out.end(),
+                reinterpret_cast<const char*>(entity_manager.versions.data()),
+                reinterpret_cast<const char*>(entity_manager.versions.data() + entity_manager.versions.size())
+            );
+            pad(out);
+
+            for (const auto& archetype : archetypes)
+            {
+                const Mask mask = archetype->mask & saved_mask;
+                write(out, uint64_t(mask.count()));
+                for (size_t type = 0; type + 1 < MAX_NUM_COMPONENT_TYPES; ++type)
+                {
+                    if (mask.test(type + 1))
+                    {
+                        write(out, uint64_t(type));
+                    }
+                }
+                writeEntities(out, archetype->entities);
+                ([&]
+                {
+                    if constexpr (!SparseSetStorage<Targs>::value)
+                    {
+                        if (archetype->columns[EntityManager::type_id<Targs>] != nullptr)
+                        {
+                            const auto& column = archetype->template column<Targs>();
+                            write(out, uint64_t(EntityManager::type_id<Targs>));
+                            writeComponents(out, column.data(), column.size());
+                        }
+                    }
+                }(), ...);
+            }
+
+            ([&]
+            {
+                write(out, uint64_t(EntityManager::type_id<Targs>));
+                if constexpr (SparseSetStorage<Targs>::value)
+                {
+                    const auto* sparse_set = static_cast<const EntityManager::SparseSet<Targs>*>(
+                        entity_manager.sparse_sets[EntityManager::type_id<Targs>].get()
+                    );
+                    if (sparse_set != nullptr)
+                    {
+                        writeEntities(out, sparse_set->entities());
+                        writeComponents(out, sparse_set->data.data(), sparse_set->data.size());
+                        return;
+                    }
+                }
+                writeEntities(out, {});
+            }(), ...);
+
+            std::ofstream file(file_path, std::ios::binary | std::ios::trunc);
+            file.write(out.data(), static_cast<std::streamsize>(out.size()));
+            if (!file)
+            {
+                throw std::runtime_error(
+                    std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                    "Can't write snapshot to " + file_path.string() + ".");
+            }
+        }
+
+        // entity_manager has to be empty, i.e. no entity has ever been created with it
+        template<typename... Targs>
+        static void restore(EntityManager& entity_manager, const std::filesystem::path& file_path)
+        {
+            static_assert(((ComponentTypeId<Targs>::value != SIZE_MAX) && ...), "Only registered component types can be restored.");
+            if (!entity_manager.versions.empty())
+            {
+                throw std::runtime_error(
+                    std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                    "Can't restore snapshot. Entity manager is not empty.");
+            }
+            assert(entity_manager.num_active_parallel_runs == 0 && "Structural changes are not allowed during parallelRun().");
+
+            std::array<const TypeFunctions*, MAX_NUM_REGISTERED_COMPONENT_TYPES> type_functions{};
+            ((type_functions[EntityManager::type_id<Targs>] = &typeFunctions<Targs>()), ...);
+
+            const MappedFile file(file_path);
+            SnapshotReader in(file.data(), file.data() + file.size());
+            if (in.read<std::array<char, 8>>() != magic)
+            {
+                throw std::runtime_error(
+                    std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                    "Can't restore snapshot. " + file_path.string() + " is not a snapshot.");
+            }
+            if (in.read<uint32_t>() != format_version)
+            {
+                throw std::runtime_error(
+                    std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                    "Can't restore snapshot. Unsupported snapshot format version.");
+            }
+            const auto num_ids = in.read<uint64_t>();
+            const auto num_archetypes = in.read<uint64_t>();
+            const auto num_sparse_sets = in.read<uint64_t>();
+            in.align();
+            if (num_ids > EntityManager::max_num_entities)
+            {
+                throw std::runtime_error(
+                    std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                    "Can't restore snapshot. Too many entities.");
+            }
+
+            auto& em = entity_manager;
+            const char* versions = in.bytes(num_ids, sizeof(uint32_t));
+            em.versions.resize(num_ids);
+            std::memcpy(em.versions.data(), versions, num_ids * sizeof(uint32_t));
+            in.align();
+            em.has_mask.assign(num_ids, Mask(0));
+            em.entity_locations.assign(num_ids, {});
+
+            const auto getTypeFunctions = [&](const uint64_t type) -> const TypeFunctions&
+            {
+                if (type >= type_functions.size() || type_functions[type] == nullptr)
+                {
+                    throw std::runtime_error(
+                        std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                        "Can't restore snapshot. Unknown component type id " + std::to_string(type) + ".");
+                }
+                return *type_functions[type];
+            };
+
+            const auto readEntities = [&]()
+            {
+                const auto num_entities = in.read<uint64_t>();
+                in.align();
+                const char* data = in.bytes(num_entities, sizeof(uint32_t));
+                in.align();
+                std::vector<Entity> entities(num_entities);
+                for (size_t i = 0; i < num_entities; ++i)
+                {
+                    uint32_t index;
+                    std::memcpy(&index, data + i * sizeof(uint32_t), sizeof(uint32_t));
+                    if (index >= num_ids)
+                    {
+                        throw std::runtime_error(
+                            std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                            "Can't restore snapshot. Invalid entity id.");
+                    }
+                    entities[i] = Entity(index, em.versions[index]);
+                }
+                return entities;
+            };
+
+            for (size_t a = 0; a < num_archetypes; ++a)
+            {
+                const auto num_types = in.read<uint64_t>();
+                Mask mask(1);
+                for (size_t i = 0; i < num_types; ++i)
+                {
+                    const auto type = in.read<uint64_t>();
+                    getTypeFunctions(type).register_type(em);
+                    mask.set(type + 1);
+                }
+                const std::vector<Entity> entities = readEntities();
+                const size_t archetype_index = em.getArchetype(mask);
+                auto& archetype = *em.archetypes[archetype_index];
+                archetype.reserve(entities.size());
+                for (const Entity entity : entities)
+                {
+                    if (em.has_mask[entity.m_index].test(0))
+                    {
+                        throw std::runtime_error(
+                            std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                            "Can't restore snapshot. Entity is stored twice.");
+                    }
+                    em.has_mask[entity.m_index] = mask;
+                    em.entity_locations[entity.m_index] = {archetype_index, archetype.entities.size()};
+                    archetype.entities.push_back(entity);
+                }
+                for (size_t i = 0; i < num_types; ++i)
+                {
+                    const auto type = in.read<uint64_t>();
+                    const TypeFunctions& functions = getTypeFunctions(type);
+                    if (!mask.test(type + 1) || archetype.columns[type]->change_ticks.size() != archetype.entities.size() - entities.size())
+                    {
+                        throw std::runtime_error(
+                            std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                            "Can't restore snapshot. Invalid component block.");
+                    }
+                    functions.read_column(em, archetype, in, entities.size());
+                }
+            }
+
+            for (size_t s = 0; s < num_sparse_sets; ++s)
+            {
+                const TypeFunctions& type = getTypeFunctions(in.read<uint64_t>());
+                const std::vector<Entity> entities = readEntities();
+                if (entities.empty())
+                {
+                    continue;
+                }
+                type.register_type(em);
+                type.read_sparse_set(em, entities, in);
+            }
+
+            for (size_t id = num_ids; id > 0; --id)
+            {
+                if (!em.has_mask[id - 1].test(0) && em.versions[id - 1] != UINT32_MAX)
+                {
+                    em.unused_ids.push_back(id - 1);
+                }
+            }
+            em.free_cursor.store(static_cast<int64_t>(em.unused_ids.size()), std::memory_order_relaxed);
+            if (!em.sparse_query_caches.empty())
+            {
+                for (size_t id = 0; id < num_ids; ++id)
+                {
+                    if ((em.has_mask[id] & em.sparse_set_mask).any())
+                    {
+                        em.addToQueryCaches(Entity(static_cast<uint32_t>(id), em.versions[id]), em.has_mask[id]);
+                    }
+                }
+            }
+        }
+
+    private:
+
+        using Mask = std::bitset<MAX_NUM_COMPONENT_TYPES>;
+
+        static constexpr std::array<char, 8> magic = {'G', 'L', 'O', 'M', 'E', 'E', 'C', 'S'};
+
+        struct TypeFunctions
+        {
+            void (* register_type)(EntityManager&);
+            void (* read_column)(EntityManager&, EntityManager::Archetype&, SnapshotReader&, size_t);
+            void (* read_sparse_set)(EntityManager&, const std::vector<Entity>&, SnapshotReader&);
+        };
+
+        // Maps a file and unmaps it again when destroyed. Falls back to reading the whole file where mmap is
+        // not available.
+        class MappedFile
+        {
+        public:
+
+            explicit MappedFile(const std::filesystem::path& file_path)
+            {
+#if defined(__unix__) || defined(__APPLE__)
+                const int fd = open(file_path.c_str(), O_RDONLY);
+                struct stat file_stat{};
+                if (fd >= 0 && fstat(fd, &file_stat) == 0)
+                {
+                    m_size = static_cast<size_t>(file_stat.st_size);
+                    void* mapping = m_size == 0 ? nullptr : mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (mapping != MAP_FAILED)
+                    {
+                        m_mapping = static_cast<const char*>(mapping);
+                        close(fd);
+                        return;
+                    }
+                }
+                if (fd >= 0)
+                {
+                    close(fd);
+                }
+#endif
+                std::ifstream file(file_path, std::ios::binary | std::ios::ate);
+                if (!file)
+                {
+                    throw std::runtime_error(
+                        std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                        "Can't open snapshot " + file_path.string() + ".");
+                }
+                m_size = static_cast<size_t>(file.tellg());
+                m_buffer = std::make_unique<char[]>(m_size);
+                file.seekg(0);
+                file.read(m_buffer.get(), static_cast<std::streamsize>(m_size));
+            }
+
+            MappedFile(const MappedFile&) = delete;
+
+            void operator=(const MappedFile&) = delete;
+
+            ~MappedFile()
+            {
+#if defined(__unix__) || defined(__APPLE__)
+                if (m_mapping != nullptr)
+                {
+                    munmap(const_cast<char*>(m_mapping), m_size);
+                }
+#endif
+            }
+
+            [[nodiscard]] const char* data() const
+            {
+                return m_mapping != nullptr ? m_mapping : m_buffer.get();
+            }
+
+            [[nodiscard]] size_t size() const
+            {
+                return m_size;
+            }
+
+        private:
+
+            const char* m_mapping = nullptr;
+            std::unique_ptr<char[]> m_buffer;
+            size_t m_size = 0;
+        };
+
+        template<typename T>
+        static void write(std::vector<char>& out, const T& value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            out.insert(out.end(), reinterpret_cast<const char*>(&value), reinterpret_cast<const char*>(&value) + sizeof(T));
+        }
+
+        static void pad(std::vector<char>& out)
+        {
+            out.resize(out.size() + (SnapshotReader::block_alignment - out.size() % SnapshotReader::block_alignment) %
+                                    SnapshotReader::block_alignment, 0);
+        }
+
+        static void writeEntities(std::vector<char>& out, const std::vector<Entity>& entities)
+        {
+            write(out, uint64_t(entities.size()));
+            pad(out);
+            for (const Entity entity : entities)
+            {
+                write(out, entity.m_index);
+            }
+            pad(out);
+        }
+
+        template<typename T>
+        static void writeComponents(std::vector<char>& out, const T* components, const size_t num_components)
+        {
+            if constexpr (std::is_trivially_copyable_v<T>)
+            {
+                static_assert(alignof(T) <= SnapshotReader::block_alignment);
+                out.insert(
+                    out.end(),
+                    reinterpret_cast<const char*>(components),
+                    reinterpret_cast<const char*>(components + num_components)
+                );
+            }
+            else
+            {
+                for (size_t i = 0; i < num_components; ++i)
+                {
+                    SnapshotSerializer<T>::write(out, components[i]);
+                }
+            }
+            pad(out);
+        }
+
+        // reads num_components components that have been written by writeComponents() and passes them to f
+        template<typename T, typename F>
+        static void readComponents(SnapshotReader& in, const size_t num_components, F f)
+        {
+            if constexpr (std::is_trivially_copyable_v<T>)
+            {
+                const T* components = reinterpret_cast<const T*>(in.bytes(num_components, sizeof(T)));
+                f(components, components + num_components);
+            }
+            else
+            {
+                std::vector<T> components;
+                // a corrupt count must not allocate more than the snapshot could contain
+                components.reserve(std::min(num_components, in.remaining()));
+                for (size_t i = 0; i < num_components; ++i)
+                {
+                    components.push_back(SnapshotSerializer<T>::read(in));
+                }
+                f(std::make_move_iterator(components.begin()), std::make_move_iterator(components.end()));
+            }
+            in.align();
+        }
+
+        template<typename T>
+        static const TypeFunctions& typeFunctions()
+        {
+            static const TypeFunctions functions{
+                [](EntityManager& em)
+                {
+                    em.registerComponentType<T>();
+                },
+                [](EntityManager& em, EntityManager::Archetype& archetype, SnapshotReader& in, const size_t num_rows)
+                {
+                    if constexpr (!SparseSetStorage<T>::value)
+                    {
+                        readComponents<T>(in, num_rows, [&](auto begin, auto end)
+                        {
+                            auto& column = archetype.template column<T>();
+                            column.insert(column.end(), begin, end);
+                            auto& change_ticks = archetype.columns[EntityManager::type_id<T>]->change_ticks;
+                            change_ticks.insert(change_ticks.end(), num_rows, em.change_tick);
+                        });
+                    }
+                },
+                [](EntityManager& em, const std::vector<Entity>& entities, SnapshotReader& in)
+                {
+                    if constexpr (SparseSetStorage<T>::value)
+                    {
+                        auto& sparse_set = static_cast<EntityManager::SparseSet<T>&>(*em.sparse_sets[EntityManager::type_id<T>]);
+                        readComponents<T>(in, entities.size(), [&](auto begin, auto)
+                        {
+                            for (const Entity entity : entities)
+                            {
+                                if (!em.has_mask[entity.m_index].test(0) || sparse_set.contains(entity.m_index))
+                                {
+                                    throw std::runtime_error(
+                                        std::string(__FILE__) + ":" + std::to_string(__LINE__) + ": " +
+                                        "Can't restore snapshot. Invalid sparse set entity.");
+                                }
+                                sparse_set.insert(entity, T(*begin), em.change_tick);
+                                ++begin;
+                                em.has_mask[entity.m_index] |= EntityManager::bit_id<T>;
+                            }
+                        });
+                    }
+                }
+            };
+            return functions;
+        }
+    };
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+#include "types.hpp"
+#include "shared_glm_glsl.h"
+#include <span>
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+#include <limits>
+
+namespace motion_batch
+{
+    // Number of entities that are processed together. Four SSE registers of floats in the default build, one AVX-512
+    // or two AVX2 registers with GLOME_NATIVE_ARCH on machines that support them.
+    constexpr size_t lanes = 16;
+
+    // m[column * 4 + row][lane] of the orientations begin, ..., begin + count - 1, unused lanes stay at rest
+    inline void load(
+        std::span<const HypersphereOrientation> orientations,
+        const size_t begin,
+        const size_t count,
+        float (&m)[16][lanes]
+    )
+    {
+        if (count < lanes)
+        {
+            std::fill(&m[0][0], &m[0][0] + 16 * lanes, 0.0f);
+        }
+        for (size_t lane = 0; lane < count; ++lane)
+        {
+            // components are accessed by name, glm's operator[] is a switch
+            const glm::mat3x4& axes = orientations[begin + lane].orientation();
+            const glm::vec4& coord = orientations[begin + lane].coord();
+            for (int column = 0; column < 3; ++column)
+            {
+                m[column * 4][lane] = axes[column].x;
+                m[column * 4 + 1][lane] = axes[column].y;
+                m[column * 4 + 2][lane] = axes[column].z;
+                m[column * 4 + 3][lane] = axes[column].w;
+            }
+            m[12][lane] = coord.x;
+            m[13][lane] = coord.y;
+            m[14][lane] = coord.z;
+            m[15][lane] = coord.w;
+        }
+    }
+
+    inline void store(
+        const float (&m)[16][lanes],
+        const size_t lane,
+        HypersphereOrientation& orientation
+    )
+    {
+        glm::mat3x4& axes = orientation.orientation();
+        for (int column = 0; column < 3; ++column)
+        {
+            axes[column] = glm::vec4(
+                m[column * 4][lane], m[column * 4 + 1][lane], m[column * 4 + 2][lane], m[column * 4 + 3][lane]
+            );
+        }
+        orientation.coord() = glm::vec4(m[12][lane], m[13][lane], m[14][lane], m[15][lane]);
+    }
+
+    // Moves every orientation by velocity * delta, like
+    //     glm::hs::getHypersphereOrientation(orientation, glm::mat3(1.0), velocity * delta, radius)
+    // does for one. The rotation in the plane of the coordinate p and the direction of movement u is applied in
+    // closed form: p' = cos(a) * p + sin(a) * u and e_i' = e_i + (u . e_i) * ((cos(a) - 1) * u - sin(a) * p), where
+    // u . e_i = v_i / |v| for an orthonormal orientation. Orientations are transposed into blocks of lanes entities
+    // that are processed as a structure of arrays.
+    inline void integrate(
+        std::span<HypersphereOrientation> orientations,
+        std::span<const Velocity3D> velocities,
+        const Second<float> delta,
+        const Metre<float> radius
+    )
+    {
+        assert(orientations.size() == velocities.size());
+        const float inverse_radius = 1.0f / radius.value;
+        for (size_t begin = 0; begin < orientations.size(); begin += lanes)
+        {
+            const size_t count = std::min(lanes, orientations.size() - begin);
+
+            alignas(64) float m[16][lanes];
+            alignas(64) float v[3][lanes];
+            load(orientations, begin, count, m);
+            if (count < lanes)
+            {
+                std::fill(&v[0][0], &v[0][0] + 3 * lanes, 0.0f);
+            }
+            for (size_t lane = 0; lane < count; ++lane)
+            {
+                const glm::vec3 offset = velocities[begin + lane].value * delta.value;
+                v[0][lane] = offset.x;
+                v[1][lane] = offset.y;
+                v[2][lane] = offset.z;
+            }
+
+            // written without inner loops, -O2 only vectorizes loops whose body is straight code
+            for (size_t lane = 0; lane < lanes; ++lane)
+            {
+                const float u0 = v[0][lane] * m[0][lane] + v[1][lane] * m[4][lane] + v[2][lane] * m[8][lane];
+                const float u1 = v[0][lane] * m[1][lane] + v[1][lane] * m[5][lane] + v[2][lane] * m[9][lane];
+                const float u2 = v[0][lane] * m[2][lane] + v[1][lane] * m[6][lane] + v[2][lane] * m[10][lane];
+                const float u3 = v[0][lane] * m[3][lane] + v[1][lane] * m[7][lane] + v[2][lane] * m[11][lane];
+                const float length = std::sqrt(u0 * u0 + u1 * u1 + u2 * u2 + u3 * u3);
+                // no movement gives sin = 0, cos = 1 and u = 0, i.e. the identity
+                const float inverse_length = 1.0f / (length + std::numeric_limits<float>::min());
+                const glm::vec2 sin_cos = glm::hs::approx_sin_cos(length * inverse_radius);
+                const float s = sin_cos.x;
+                const float c = sin_cos.y;
+
+                // (cos(a) - 1) * u - sin(a) * p with normalized u
+                const float c_u = (c - 1.0f) * inverse_length;
+                const float w0 = c_u * u0 - s * m[12][lane];
+                const float w1 = c_u * u1 - s * m[13][lane];
+                const float w2 = c_u * u2 - s * m[14][lane];
+                const float w3 = c_u * u3 - s * m[15][lane];
+
+                const float s_u = s * inverse_length;
+                m[12][lane] = c * m[12][lane] + s_u * u0;
+                m[13][lane] = c * m[13][lane] + s_u * u1;
+                m[14][lane] = c * m[14][lane] + s_u * u2;
+                m[15][lane] = c * m[15][lane] + s_u * u3;
+
+                const auto move = [&](const int column)
+                {
+                    const float u_dot_e = v[column][lane] * inverse_length;
+                    m[column * 4][lane] += u_dot_e * w0;
+                    m[column * 4 + 1][lane] += u_dot_e * w1;
+                    m[column * 4 + 2][lane] += u_dot_e * w2;
+                    m[column * 4 + 3][lane] += u_dot_e * w3;
+                };
+                move(0);
+                move(1);
+                move(2);
+            }
+
+            for (size_t lane = 0; lane < count; ++lane)
+            {
+                store(m, lane, orientations[begin + lane]);
+            }
+        }
+    }
+
+    // Like glm::hs::orthonormalize() for every orientation whose glm::hs::orthonormalityError() is larger than
+    // tolerance, on_corrected(i) is called for each of them. Rotations are composed many times per second, so the
+    // axes slowly drift away from an orthonormal basis.
+    template<typename F>
+    void orthonormalize(std::span<HypersphereOrientation> orientations, const float tolerance, F on_corrected)
+    {
+        for (size_t begin = 0; begin < orientations.size(); begin += lanes)
+        {
+            const size_t count = std::min(lanes, orientations.size() - begin);
+
+            alignas(64) float m[16][lanes];
+            alignas(64) float error[lanes];
+            load(orientations, begin, count, m);
+
+            for (size_t lane = 0; lane < lanes; ++lane)
+            {
+                const auto dot = [&](const int a, const int b)
+                {
+                    return m[a * 4][lane] * m[b * 4][lane] + m[a * 4 + 1][lane] * m[b * 4 + 1][lane] +
+                           m[a * 4 + 2][lane] * m[b * 4 + 2][lane] + m[a * 4 + 3][lane] * m[b * 4 + 3][lane];
+                };
+                // glm::hs::orthonormalityError(), so the tolerance means the same as on the scalar path. std::max()
+                // keeps -O2 from vectorizing the loop, for non negative a and b this equals it up to rounding.
+                const auto maximum = [](const float a, const float b)
+                {
+                    return 0.5f * (a + b + std::abs(a - b));
+                };
+                error[lane] = maximum(
+                    maximum(
+                        maximum(std::abs(dot(0, 0) - 1.0f), std::abs(dot(1, 1) - 1.0f)),
+                        maximum(std::abs(dot(2, 2) - 1.0f), std::abs(dot(3, 3) - 1.0f))
+                    ),
+                    maximum(
+                        maximum(maximum(std::abs(dot(0, 1)), std::abs(dot(0, 2))), maximum(std::abs(dot(0, 3)), std::abs(dot(1, 2)))),
+                        maximum(std::abs(dot(1, 3)), std::abs(dot(2, 3)))
+                    )
+                );
+
+                // unused lanes are zero, they get a zero instead of an infinite scale
+                const auto normalize = [&](const int a)
+                {
+                    const float scale = 1.0f / (std::sqrt(dot(a, a)) + std::numeric_limits<float>::min());
+                    m[a * 4][lane] *= scale;
+                    m[a * 4 + 1][lane] *= scale;
+                    m[a * 4 + 2][lane] *= scale;
+                    m[a * 4 + 3][lane] *= scale;
+                };
+                const auto subtractProjection = [&](const int a, const int onto)
+                {
+                    const float projection = dot(a, onto);
+                    m[a * 4][lane] -= projection * m[onto * 4][lane];
+                    m[a * 4 + 1][lane] -= projection * m[onto * 4 + 1][lane];
+                    m[a * 4 + 2][lane] -= projection * m[onto * 4 + 2][lane];
+                    m[a * 4 + 3][lane] -= projection * m[onto * 4 + 3][lane];
+                };
+                normalize(3);
+                subtractProjection(0, 3);
+                normalize(0);
+                subtractProjection(1, 3);
+                subtractProjection(1, 0);
+                normalize(1);
+                subtractProjection(2, 3);
+                subtractProjection(2, 0);
+                subtractProjection(2, 1);
+                normalize(2);
+            }
+
+            for (size_t lane = 0; lane < count; ++lane)
+            {
+                if (error[lane] > tolerance)
+                {
+                    store(m, lane, orientations[begin + lane]);
+                    on_corrected(begin + lane);
+                }
+            }
+        }
+    }
+}
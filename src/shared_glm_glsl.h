@@ -20,148 +20,187 @@ namespace glm::hs
 #define inline
 #endif
 
-    inline float safe_acos(float v)
+// 1 replaces sin(), cos() and acos() with the polynomial approximations below. Shaders get it via #insert. On the CPU
+// only acos() is replaced, single calls of approx_sin_cos() aren't faster than the standard library, only vectorized
+// loops like the ones in motion_batch.hpp are.
+#ifndef FAST_HS_MATH
+#define FAST_HS_MATH 0
+#endif
+
+    inline float pi()
+    {
+        return radians(180.0f);
+    }
+
+    // (sin(x), cos(x)) with an absolute error below 1e-7 for |x| < 1e4. Has no branches, so CPU loops over it get
+    // vectorized.
+    inline vec2 approx_sin_cos(const float x)
     {
-        return acos(clamp(v, -1.0f, 1.0f));
+        // rounded by conversion, floor() is a library call on CPUs without SSE4.1
+        int quadrant = int(x * 0.636619772f + step(0.0f, x) - 0.5f);
+        float k = float(quadrant);
+        // x - k * pi/2 with pi/2 split into three parts so that the first two products are exact, which keeps the
+        // relative error small near the zeros
+        float r = ((x - k * 1.5703125f) - k * 4.837512969970703125e-4f) - k * 7.549790126404332e-8f;
+        float r2 = r * r;
+        float sin_r = r + r * r2 * (-1.6666654611e-1f + r2 * (8.3321608736e-3f + r2 * -1.9515295891e-4f));
+        float cos_r = 1.0f - 0.5f * r2 + r2 * r2 * (4.166664568298827e-2f + r2 * (-1.388731625493765e-3f + r2 * 2.443315711809948e-5f));
+        // the quadrant selects and negates sin_r and cos_r, written as arithmetic instead of branches
+        float swap = float(quadrant & 1);
+        return vec2(
+            (swap * cos_r + (1.0f - swap) * sin_r) * (1.0f - float(quadrant & 2)),
+            (swap * sin_r + (1.0f - swap) * cos_r) * (1.0f - float((quadrant + 1) & 2))
+        );
     }
 
+    inline float approx_sin(const float x)
+    {
+        return approx_sin_cos(x).x;
+    }
 
-    inline float pi()
+    inline float approx_cos(const float x)
     {
-        return radians(180.0f);
+        return approx_sin_cos(x).y;
+    }
+
+    // acos(x) for x in [-1, 1] with an absolute error below 1e-6 (Abramowitz and Stegun 4.4.46)
+    inline float approx_acos(const float x)
+    {
+        float a = abs(x);
+        float p = 1.5707963050f + a * (-0.2145988016f + a * (0.0889789874f + a * (-0.0501743046f + a * (
+            0.0308918810f + a * (-0.0170881256f + a * (0.0066700901f + a * -0.0012624911f))))));
+        float negative = 1.0f - step(0.0f, x);
+        return negative * pi() + (1.0f - 2.0f * negative) * sqrt(1.0f - a) * p;
+    }
+
+    inline float hs_sin(const float x)
+    {
+#if FAST_HS_MATH && defined(_glsl)
+        return approx_sin(x);
+#else
+        return sin(x);
+#endif
+    }
+
+    inline float hs_cos(const float x)
+    {
+#if FAST_HS_MATH && defined(_glsl)
+        return approx_cos(x);
+#else
+        return cos(x);
+#endif
+    }
+
+    inline float hs_acos(const float x)
+    {
+#if FAST_HS_MATH
+        return approx_acos(x);
+#else
+        return acos(x);
+#endif
+    }
+
+    inline float safe_acos(float v)
+    {
+        return hs_acos(clamp(v, -1.0f, 1.0f));
     }
 
     // TODO: class 3: define where stuff needs to be normalized and minimize use of normalize()
 
+    // normalize() that returns a zero vector instead of NaNs for a zero vector
+    inline vec4 safe_normalize(const vec4 v)
+    {
+        return v / max(length(v), 1e-30f);
+    }
+
+    // vector orthogonal to a, b and c, i.e. the cofactors of the last row of the matrix (a, b, c, x). The sign is
+    // chosen so that the sum of the components is positive. Zero if a, b and c are linearly dependent.
     inline vec4 cross3(const vec4 a, const vec4 b, const vec4 c)
     {
-        vec4 ret;
-        ret.x = (a.w * b.y * c.z - a.w * b.z * c.y - a.y * b.w * c.z + a.y * b.z * c.w + a.z * b.w * c.y - a.z * b.y * c.w) /
-                (a.w * b.x * c.y - a.w * b.y * c.x - a.x * b.w * c.y + a.x * b.y * c.w + a.y * b.w * c.x - a.y * b.x * c.w
-                 - a.w * b.x * c.z + a.w * b.z * c.x + a.x * b.w * c.z - a.x * b.z * c.w - a.z * b.w * c.x + a.z * b.x * c.w
-                 + a.w * b.y * c.z - a.w * b.z * c.y - a.y * b.w * c.z + a.y * b.z * c.w + a.z * b.w * c.y - a.z * b.y * c.w
-                 - a.x * b.y * c.z + a.x * b.z * c.y + a.y * b.x * c.z - a.y * b.z * c.x - a.z * b.x * c.y + a.z * b.y * c.x);
-        ret.y = -(a.w * b.x * c.z - a.w * b.z * c.x - a.x * b.w * c.z + a.x * b.z * c.w + a.z * b.w * c.x - a.z * b.x * c.w) /
-                (a.w * b.x * c.y - a.w * b.y * c.x - a.x * b.w * c.y + a.x * b.y * c.w + a.y * b.w * c.x - a.y * b.x * c.w
-                 - a.w * b.x * c.z + a.w * b.z * c.x + a.x * b.w * c.z - a.x * b.z * c.w - a.z * b.w * c.x + a.z * b.x * c.w
-                 + a.w * b.y * c.z - a.w * b.z * c.y - a.y * b.w * c.z + a.y * b.z * c.w + a.z * b.w * c.y - a.z * b.y * c.w
-                 - a.x * b.y * c.z + a.x * b.z * c.y + a.y * b.x * c.z - a.y * b.z * c.x - a.z * b.x * c.y + a.z * b.y * c.x);
-        ret.z = (a.w * b.x * c.y - a.w * b.y * c.x - a.x * b.w * c.y + a.x * b.y * c.w + a.y * b.w * c.x - a.y * b.x * c.w) /
-                (a.w * b.x * c.y - a.w * b.y * c.x - a.x * b.w * c.y + a.x * b.y * c.w + a.y * b.w * c.x - a.y * b.x * c.w
-                 - a.w * b.x * c.z + a.w * b.z * c.x + a.x * b.w * c.z - a.x * b.z * c.w - a.z * b.w * c.x + a.z * b.x * c.w
-                 + a.w * b.y * c.z - a.w * b.z * c.y - a.y * b.w * c.z + a.y * b.z * c.w + a.z * b.w * c.y - a.z * b.y * c.w
-                 - a.x * b.y * c.z + a.x * b.z * c.y + a.y * b.x * c.z - a.y * b.z * c.x - a.z * b.x * c.y + a.z * b.y * c.x);
-        ret.w = -(a.x * b.y * c.z - a.x * b.z * c.y - a.y * b.x * c.z + a.y * b.z * c.x + a.z * b.x * c.y - a.z * b.y * c.x) /
-                (a.w * b.x * c.y - a.w * b.y * c.x - a.x * b.w * c.y + a.x * b.y * c.w + a.y * b.w * c.x - a.y * b.x * c.w
-                 - a.w * b.x * c.z + a.w * b.z * c.x + a.x * b.w * c.z - a.x * b.z * c.w - a.z * b.w * c.x + a.z * b.x * c.w
-                 + a.w * b.y * c.z - a.w * b.z * c.y - a.y * b.w * c.z + a.y * b.z * c.w + a.z * b.w * c.y - a.z * b.y * c.w
-                 - a.x * b.y * c.z + a.x * b.z * c.y + a.y * b.x * c.z - a.y * b.z * c.x - a.z * b.x * c.y + a.z * b.y * c.x);
-
-        ret = normalize(ret);
-        return ret;
+        // 2x2 minors of b and c, shared by all four 3x3 determinants
+        float xy = b.x * c.y - b.y * c.x;
+        float xz = b.x * c.z - b.z * c.x;
+        float xw = b.x * c.w - b.w * c.x;
+        float yz = b.y * c.z - b.z * c.y;
+        float yw = b.y * c.w - b.w * c.y;
+        float zw = b.z * c.w - b.w * c.z;
+        vec4 ret = vec4(
+            a.y * zw - a.z * yw + a.w * yz,
+            -a.x * zw + a.z * xw - a.w * xz,
+            a.x * yw - a.y * xw + a.w * xy,
+            -a.x * yz + a.y * xz - a.z * xy
+        );
+        if (ret.x + ret.y + ret.z + ret.w < 0.0f)
+        {
+            ret = -ret;
+        }
+        return safe_normalize(ret);
     }
 
-    //finds plane that is orthogonal to t and v
+    // part of t that is orthogonal to v, scaled by dot(v, v). Computed from the 2x2 minors of t and v, so that
+    // the projection onto v doesn't cancel out with t, which would make it inaccurate for almost parallel t and v.
+    inline vec4 orthogonalPart(const vec4 t, const vec4 v)
+    {
+        float xy = t.x * v.y - t.y * v.x;
+        float xz = t.x * v.z - t.z * v.x;
+        float xw = t.x * v.w - t.w * v.x;
+        float yz = t.y * v.z - t.z * v.y;
+        float yw = t.y * v.w - t.w * v.y;
+        float zw = t.z * v.w - t.w * v.z;
+        return vec4(
+            v.y * xy + v.z * xz + v.w * xw,
+            -v.x * xy + v.z * yz + v.w * yw,
+            -v.x * xz - v.y * yz + v.w * zw,
+            -v.x * xw - v.y * yw - v.z * zw
+        );
+    }
+
+    // finds an orthonormal basis of the plane that is orthogonal to t and v
     inline mat2x4 orthogonalPlane(const vec4 t, const vec4 v)
     {
+        // Each unit vector gives a vector orthogonal to t, v and itself, made of the 2x2 minors of t and v without its
+        // component. Its squared length is the squared volume spanned by t, v and the unit vector, so the longest one
+        // is the most stable choice.
+        float xy = t.x * v.y - t.y * v.x;
+        float xz = t.x * v.z - t.z * v.x;
+        float xw = t.x * v.w - t.w * v.x;
+        float yz = t.y * v.z - t.z * v.y;
+        float yw = t.y * v.w - t.w * v.y;
+        float zw = t.z * v.w - t.w * v.z;
+        vec4 volumes = vec4(
+            yz * yz + yw * yw + zw * zw,
+            xz * xz + xw * xw + zw * zw,
+            xy * xy + xw * xw + yw * yw,
+            xy * xy + xz * xz + yz * yz
+        );
+        vec4 axis = vec4(0.0f, zw, -yw, yz);
+        float largest = volumes.x;
+        if (volumes.y > largest)
+        {
+            axis = vec4(zw, 0.0f, -xw, xz);
+            largest = volumes.y;
+        }
+        if (volumes.z > largest)
+        {
+            axis = vec4(yw, -xw, 0.0f, xy);
+            largest = volumes.z;
+        }
+        if (volumes.w > largest)
+        {
+            axis = vec4(yz, -xz, xy, 0.0f);
+        }
         mat2x4 ret;
-        ret[0].x = -(t.w * v.y - t.y * v.w + t.y * v.z - t.z * v.y) /
-                   (t.w * v.x - t.x * v.w - t.w * v.y + t.y * v.w + t.x * v.z - t.z * v.x - t.y * v.z + t.z * v.y);
-        ret[0].y = (t.w * v.x - t.x * v.w + t.x * v.z - t.z * v.x) /
-                   (t.w * v.x - t.x * v.w - t.w * v.y + t.y * v.w + t.x * v.z - t.z * v.x - t.y * v.z + t.z * v.y);
-        ret[0].z = -(t.x * v.y - t.y * v.x) / (t.w * v.x - t.x * v.w - t.w * v.y + t.y * v.w + t.x * v.z - t.z * v.x - t.y * v.z + t.z * v.y);
-        ret[0].w = (t.x * v.y - t.y * v.x) / (t.w * v.x - t.x * v.w - t.w * v.y + t.y * v.w + t.x * v.z - t.z * v.x - t.y * v.z + t.z * v.y);
-        float sigma_1 = t.x * t.z * v.y * v.y;
-        float sigma_2 = t.x * t.z * v.w * v.w;
-        ret[1].x = -(v.x * t.w * t.w * v.z - v.x * t.w * t.y * v.y - v.x * t.w * t.z * v.w - v.x * t.w * t.z * v.z - t.x * t.w * v.w * v.z +
-                     t.x * t.w * v.y * v.y + t.x * t.w * v.z * v.z + v.x * t.y * t.y * v.w + v.x * t.y * t.y * v.z - v.x * t.y * t.z * v.y -
-                     t.x * t.y * v.w * v.y - t.x * t.y * v.y * v.z + v.x * t.z * t.z * v.w + sigma_2 - t.x * t.z * v.w * v.z + sigma_1) /
-                   (t.w * t.w * v.x * v.x - t.w * t.w * v.x * v.z + t.w * t.w * v.y * v.y - t.w * t.w * v.y * v.z - 2 * t.w * t.x * v.w * v.x +
-                    t.w * t.x * v.w * v.z + t.w * t.x * v.x * v.y + 2 * t.w * t.x * v.x * v.z - t.w * t.x * v.y * v.y - t.w * t.x * v.z * v.z -
-                    2 * t.w * t.y * v.w * v.y + t.w * t.y * v.w * v.z - t.w * t.y * v.x * v.x + t.w * t.y * v.x * v.y + 2 * t.w * t.y * v.y * v.z -
-                    t.w * t.y * v.z * v.z + t.w * t.z * v.w * v.x + t.w * t.z * v.w * v.y - 2 * t.w * t.z * v.x * v.x + t.w * t.z * v.x * v.z -
-                    2 * t.w * t.z * v.y * v.y + t.w * t.z * v.y * v.z + t.x * t.x * v.w * v.w - t.x * t.x * v.w * v.y - 2 * t.x * t.x * v.w * v.z +
-                    2 * t.x * t.x * v.y * v.y - t.x * t.x * v.y * v.z + t.x * t.x * v.z * v.z + t.x * t.y * v.w * v.x + t.x * t.y * v.w * v.y -
-                    4 * t.x * t.y * v.x * v.y + t.x * t.y * v.x * v.z + t.x * t.y * v.y * v.z - sigma_2 + 2 * t.x * t.z * v.w * v.x +
-                    t.x * t.z * v.w * v.z + t.x * t.z * v.x * v.y - 2 * t.x * t.z * v.x * v.z - sigma_1 + t.y * t.y * v.w * v.w -
-                    t.y * t.y * v.w * v.x - 2 * t.y * t.y * v.w * v.z + 2 * t.y * t.y * v.x * v.x - t.y * t.y * v.x * v.z + t.y * t.y * v.z * v.z -
-                    t.y * t.z * v.w * v.w + 2 * t.y * t.z * v.w * v.y + t.y * t.z * v.w * v.z - t.y * t.z * v.x * v.x + t.y * t.z * v.x * v.y -
-                    2 * t.y * t.z * v.y * v.z - t.z * t.z * v.w * v.x - t.z * t.z * v.w * v.y + t.z * t.z * v.x * v.x + t.z * t.z * v.y * v.y);
-        float sigma_3 = t.y * t.z * v.x * v.x;
-        float sigma_4 = t.y * t.z * v.w * v.w;
-        ret[1].y = -(v.y * t.w * t.w * v.z - v.y * t.w * t.x * v.x - v.y * t.w * t.z * v.w - v.y * t.w * t.z * v.z - t.y * t.w * v.w * v.z +
-                     t.y * t.w * v.x * v.x + t.y * t.w * v.z * v.z + v.y * t.x * t.x * v.w + v.y * t.x * t.x * v.z - v.y * t.x * t.z * v.x -
-                     t.y * t.x * v.w * v.x - t.y * t.x * v.x * v.z + v.y * t.z * t.z * v.w + sigma_4 - t.y * t.z * v.w * v.z + sigma_3) /
-                   (t.w * t.w * v.x * v.x - t.w * t.w * v.x * v.z + t.w * t.w * v.y * v.y - t.w * t.w * v.y * v.z - 2 * t.w * t.x * v.w * v.x +
-                    t.w * t.x * v.w * v.z + t.w * t.x * v.x * v.y + 2 * t.w * t.x * v.x * v.z - t.w * t.x * v.y * v.y - t.w * t.x * v.z * v.z -
-                    2 * t.w * t.y * v.w * v.y + t.w * t.y * v.w * v.z - t.w * t.y * v.x * v.x + t.w * t.y * v.x * v.y + 2 * t.w * t.y * v.y * v.z -
-                    t.w * t.y * v.z * v.z + t.w * t.z * v.w * v.x + t.w * t.z * v.w * v.y - 2 * t.w * t.z * v.x * v.x + t.w * t.z * v.x * v.z -
-                    2 * t.w * t.z * v.y * v.y + t.w * t.z * v.y * v.z + t.x * t.x * v.w * v.w - t.x * t.x * v.w * v.y - 2 * t.x * t.x * v.w * v.z +
-                    2 * t.x * t.x * v.y * v.y - t.x * t.x * v.y * v.z + t.x * t.x * v.z * v.z + t.x * t.y * v.w * v.x + t.x * t.y * v.w * v.y -
-                    4 * t.x * t.y * v.x * v.y + t.x * t.y * v.x * v.z + t.x * t.y * v.y * v.z - t.x * t.z * v.w * v.w + 2 * t.x * t.z * v.w * v.x +
-                    t.x * t.z * v.w * v.z + t.x * t.z * v.x * v.y - 2 * t.x * t.z * v.x * v.z - t.x * t.z * v.y * v.y + t.y * t.y * v.w * v.w -
-                    t.y * t.y * v.w * v.x - 2 * t.y * t.y * v.w * v.z + 2 * t.y * t.y * v.x * v.x - t.y * t.y * v.x * v.z + t.y * t.y * v.z * v.z -
-                    sigma_4 + 2 * t.y * t.z * v.w * v.y + t.y * t.z * v.w * v.z - sigma_3 + t.y * t.z * v.x * v.y - 2 * t.y * t.z * v.y * v.z -
-                    t.z * t.z * v.w * v.x - t.z * t.z * v.w * v.y + t.z * t.z * v.x * v.x + t.z * t.z * v.y * v.y);
-        float sigma_5 = t.y * t.y * v.w * v.w;
-        float sigma_6 = t.w * t.w * v.y * v.y;
-        float sigma_7 = t.x * t.x * v.w * v.w;
-        float sigma_8 = t.w * t.w * v.x * v.x;
-        float sigma_9 = 2 * t.w * t.y * v.w * v.y;
-        float sigma_10 = 2 * t.w * t.x * v.w * v.x;
-        ret[1].z =
-            (sigma_8 + sigma_6 - sigma_10 + v.z * t.w * t.x * v.x - sigma_9 + v.z * t.w * t.y * v.y - t.z * t.w * v.x * v.x - t.z * t.w * v.y * v.y +
-             sigma_7 - v.z * t.x * t.x * v.w + t.x * t.x * v.y * v.y - 2 * t.x * t.y * v.x * v.y + t.z * t.x * v.w * v.x + sigma_5 -
-             v.z * t.y * t.y * v.w + t.y * t.y * v.x * v.x + t.z * t.y * v.w * v.y) /
-            (sigma_8 - t.w * t.w * v.x * v.z + sigma_6 - t.w * t.w * v.y * v.z - sigma_10 + t.w * t.x * v.w * v.z + t.w * t.x * v.x * v.y +
-             2 * t.w * t.x * v.x * v.z - t.w * t.x * v.y * v.y - t.w * t.x * v.z * v.z - sigma_9 + t.w * t.y * v.w * v.z - t.w * t.y * v.x * v.x +
-             t.w * t.y * v.x * v.y + 2 * t.w * t.y * v.y * v.z - t.w * t.y * v.z * v.z + t.w * t.z * v.w * v.x + t.w * t.z * v.w * v.y -
-             2 * t.w * t.z * v.x * v.x + t.w * t.z * v.x * v.z - 2 * t.w * t.z * v.y * v.y + t.w * t.z * v.y * v.z + sigma_7 - t.x * t.x * v.w * v.y -
-             2 * t.x * t.x * v.w * v.z + 2 * t.x * t.x * v.y * v.y - t.x * t.x * v.y * v.z + t.x * t.x * v.z * v.z + t.x * t.y * v.w * v.x +
-             t.x * t.y * v.w * v.y - 4 * t.x * t.y * v.x * v.y + t.x * t.y * v.x * v.z + t.x * t.y * v.y * v.z - t.x * t.z * v.w * v.w +
-             2 * t.x * t.z * v.w * v.x + t.x * t.z * v.w * v.z + t.x * t.z * v.x * v.y - 2 * t.x * t.z * v.x * v.z - t.x * t.z * v.y * v.y + sigma_5 -
-             t.y * t.y * v.w * v.x - 2 * t.y * t.y * v.w * v.z + 2 * t.y * t.y * v.x * v.x - t.y * t.y * v.x * v.z + t.y * t.y * v.z * v.z -
-             t.y * t.z * v.w * v.w + 2 * t.y * t.z * v.w * v.y + t.y * t.z * v.w * v.z - t.y * t.z * v.x * v.x + t.y * t.z * v.x * v.y -
-             2 * t.y * t.z * v.y * v.z - t.z * t.z * v.w * v.x - t.z * t.z * v.w * v.y + t.z * t.z * v.x * v.x + t.z * t.z * v.y * v.y);
-        float sigma_11 = t.z * t.z * v.y * v.y;
-        float sigma_12 = t.y * t.y * v.z * v.z;
-        float sigma_13 = t.z * t.z * v.x * v.x;
-        float sigma_14 = t.x * t.x * v.z * v.z;
-        float sigma_15 = 2 * t.y * t.z * v.y * v.z;
-        float sigma_16 = 2 * t.x * t.z * v.x * v.z;
-        ret[1].w = (t.x * t.x * v.y * v.y + sigma_14 - v.w * t.x * t.x * v.z - 2 * t.x * t.y * v.x * v.y - sigma_16 + v.w * t.x * t.z * v.x +
-                    t.w * t.x * v.x * v.z + t.y * t.y * v.x * v.x + sigma_12 - v.w * t.y * t.y * v.z - sigma_15 + v.w * t.y * t.z * v.y +
-                    t.w * t.y * v.y * v.z + sigma_13 + sigma_11 - t.w * t.z * v.x * v.x - t.w * t.z * v.y * v.y) /
-                   (t.w * t.w * v.x * v.x - t.w * t.w * v.x * v.z + t.w * t.w * v.y * v.y - t.w * t.w * v.y * v.z - 2 * t.w * t.x * v.w * v.x +
-                    t.w * t.x * v.w * v.z + t.w * t.x * v.x * v.y + 2 * t.w * t.x * v.x * v.z - t.w * t.x * v.y * v.y - t.w * t.x * v.z * v.z -
-                    2 * t.w * t.y * v.w * v.y + t.w * t.y * v.w * v.z - t.w * t.y * v.x * v.x + t.w * t.y * v.x * v.y + 2 * t.w * t.y * v.y * v.z -
-                    t.w * t.y * v.z * v.z + t.w * t.z * v.w * v.x + t.w * t.z * v.w * v.y - 2 * t.w * t.z * v.x * v.x + t.w * t.z * v.x * v.z -
-                    2 * t.w * t.z * v.y * v.y + t.w * t.z * v.y * v.z + t.x * t.x * v.w * v.w - t.x * t.x * v.w * v.y - 2 * t.x * t.x * v.w * v.z +
-                    2 * t.x * t.x * v.y * v.y - t.x * t.x * v.y * v.z + sigma_14 + t.x * t.y * v.w * v.x + t.x * t.y * v.w * v.y -
-                    4 * t.x * t.y * v.x * v.y + t.x * t.y * v.x * v.z + t.x * t.y * v.y * v.z - t.x * t.z * v.w * v.w + 2 * t.x * t.z * v.w * v.x +
-                    t.x * t.z * v.w * v.z + t.x * t.z * v.x * v.y - sigma_16 - t.x * t.z * v.y * v.y + t.y * t.y * v.w * v.w - t.y * t.y * v.w * v.x -
-                    2 * t.y * t.y * v.w * v.z + 2 * t.y * t.y * v.x * v.x - t.y * t.y * v.x * v.z + sigma_12 - t.y * t.z * v.w * v.w +
-                    2 * t.y * t.z * v.w * v.y + t.y * t.z * v.w * v.z - t.y * t.z * v.x * v.x + t.y * t.z * v.x * v.y - sigma_15 -
-                    t.z * t.z * v.w * v.x - t.z * t.z * v.w * v.y + sigma_13 + sigma_11);
-
+        ret[0] = safe_normalize(axis);
+        ret[1] = cross3(t, v, ret[0]);
         return ret;
     }
 
-    // finds plane that lies in t and v
+    // finds an orthonormal basis of the plane that lies in t and v, the first axis is v
     inline mat2x4 plane(const vec4 t, const vec4 v)
     {
         mat2x4 ret;
-        ret[0] = v;
-        ret[1].x = (t.x * v.w * v.w - t.w * v.x * v.w + t.x * v.y * v.y - t.y * v.x * v.y + t.x * v.z * v.z - t.z * v.x * v.z) /
-                   (v.w * v.w + v.x * v.x + v.y * v.y + v.z * v.z);
-        ret[1].y = (t.y * v.w * v.w - t.w * v.y * v.w + t.y * v.x * v.x - t.x * v.y * v.x + t.y * v.z * v.z - t.z * v.y * v.z) /
-                   (v.w * v.w + v.x * v.x + v.y * v.y + v.z * v.z);
-        ret[1].z = (t.z * v.w * v.w - t.w * v.z * v.w + t.z * v.x * v.x - t.x * v.z * v.x + t.z * v.y * v.y - t.y * v.z * v.y) /
-                   (v.w * v.w + v.x * v.x + v.y * v.y + v.z * v.z);
-        ret[1].w = (t.w * v.x * v.x - t.x * v.w * v.x + t.w * v.y * v.y - t.y * v.w * v.y + t.w * v.z * v.z - t.z * v.w * v.z) /
-                   (v.w * v.w + v.x * v.x + v.y * v.y + v.z * v.z);
-        ret[0] = normalize(ret[0]);
-        ret[1] = normalize(ret[1]);
+        ret[0] = safe_normalize(v);
+        ret[1] = safe_normalize(orthogonalPart(t, v));
         return ret;
     }
 
@@ -171,7 +210,7 @@ namespace glm::hs
         p[1] = normalize(p[1]);
         mat4 v = outerProduct(p[0], p[0]) + outerProduct(p[1], p[1]);
         mat4 w = outerProduct(p[0], p[1]) - outerProduct(p[1], p[0]);
-        return mat4(1.0f) + (cos(alpha) - 1.0f) * v - sin(alpha) * w;
+        return mat4(1.0f) + (hs_cos(alpha) - 1.0f) * v - hs_sin(alpha) * w;
     }
 
     inline float distanceOnHypersphere(const float radius, const float angle)
@@ -213,14 +252,46 @@ namespace glm::hs
                 safe_acos(dot(normalize(from_hypersphere_orientation[3]), normalize(to_hypersphere_coord)))
             );
         }
+        // rotation keeps the axes orthonormal, the remaining drift is removed by orthonormalize() from time to time
         return mat4(
-            normalize(rotation * from_hypersphere_orientation[0]),
-            normalize(rotation * from_hypersphere_orientation[1]),
-            normalize(rotation * from_hypersphere_orientation[2]),
+            rotation * from_hypersphere_orientation[0],
+            rotation * from_hypersphere_orientation[1],
+            rotation * from_hypersphere_orientation[2],
             normalize(to_hypersphere_coord)
         );
     }
 
+    // largest deviation of a dot product of two columns from the identity, i.e. 0 for an orthonormal orientation
+    inline float orthonormalityError(const mat4 hypersphere_orientation)
+    {
+        float error = 0.0f;
+        for (int i = 0; i < 4; ++i)
+        {
+            for (int j = i; j < 4; ++j)
+            {
+                float expected = i == j ? 1.0f : 0.0f;
+                error = max(error, abs(dot(hypersphere_orientation[i], hypersphere_orientation[j]) - expected));
+            }
+        }
+        return error;
+    }
+
+    // Gram-Schmidt, starting with the coordinate so that the position doesn't move
+    inline mat4 orthonormalize(mat4 hypersphere_orientation)
+    {
+        hypersphere_orientation[3] = normalize(hypersphere_orientation[3]);
+        for (int i = 0; i < 3; ++i)
+        {
+            hypersphere_orientation[i] -= dot(hypersphere_orientation[i], hypersphere_orientation[3]) * hypersphere_orientation[3];
+            for (int j = 0; j < i; ++j)
+            {
+                hypersphere_orientation[i] -= dot(hypersphere_orientation[i], hypersphere_orientation[j]) * hypersphere_orientation[j];
+            }
+            hypersphere_orientation[i] = normalize(hypersphere_orientation[i]);
+        }
+        return hypersphere_orientation;
+    }
+
     inline mat4 get3DOffsetRotation(
         const mat4 hypersphere_orientation,
         const mat3 local_orientation_rotation,
@@ -250,6 +321,24 @@ namespace glm::hs
         ) * hypersphere_orientation[3];
     }
 
+    // model axes and coordinate in world space, i.e. the hypersphere orientation rotated by the local orientation
+    inline mat4 getModelFrame(const mat4 hypersphere_orientation, const mat3 local_orientation_rotation)
+    {
+        return hypersphere_orientation * mat4(local_orientation_rotation);
+    }
+
+    // Same as getCoord() above with the model frame computed once per object. The offset is mapped onto the
+    // hypersphere along the great circle in its direction, which is cos(a) * coord + sin(a) * direction for the angle
+    // a = |offset| / radius. Expects an orthonormal model frame.
+    inline vec4 getCoord(const mat4 model_frame, const vec3 offset_3_d, const float radius)
+    {
+        float offset_length = length(offset_3_d);
+        float angle = offset_length / radius;
+        // sin(a) / |offset| goes to 1 / radius for small offsets
+        float direction_scale = offset_length > 0.0f ? hs_sin(angle) / offset_length : 1.0f / radius;
+        return hs_cos(angle) * model_frame[3] + direction_scale * (model_frame * vec4(offset_3_d, 0.0f));
+    }
+
     inline mat4 getHypersphereOrientation(
         const mat4 hypersphere_orientation,
         const mat3 local_orientation_rotation,
@@ -277,30 +366,30 @@ namespace glm::hs
         return projection;
     }
 
+    // direction from from_coord towards to_coord in the tangent space of from_coord, zero if they are (anti)parallel
     inline vec4 getLocalDirectionalVector(const vec4 from_coord, const vec4 to_coord)
     {
-        mat2x4 axis = orthogonalPlane(from_coord, to_coord);
-        vec4 local_direction = normalize(cross3(axis[0], axis[1], from_coord));
-        float angle = safe_acos(dot(local_direction, normalize(to_coord - from_coord)));
-        if (radians(90.0f) < angle && angle <= radians(180.0f))
-        {
-            local_direction = -local_direction;
-        }
-        return local_direction;
+        return safe_normalize(orthogonalPart(to_coord, from_coord));
     }
 
-    inline vec3 getViewAngles(
-        const mat3 local_camera_orientation,
-        const mat4 camera_hypersphere_orientation,
-        const vec4 object_coord,
-        const float radius
-    )
+    // camera right, up, z and coordinate in world space. Is the same for every vertex, so it's computed once per frame.
+    inline mat4 getCameraFrame(const mat3 local_camera_orientation, const mat4 camera_hypersphere_orientation)
     {
-        vec4 camera_right = normalize(camera_hypersphere_orientation * vec4(local_camera_orientation * vec3(1.0, 0.0, 0.0), 0.0));
-        vec4 camera_up = normalize(camera_hypersphere_orientation * vec4(local_camera_orientation * vec3(0.0, 1.0, 0.0), 0.0));
-        vec4 camera_z = normalize(camera_hypersphere_orientation * vec4(local_camera_orientation * vec3(0.0, 0.0, 1.0), 0.0));
+        return mat4(
+            normalize(camera_hypersphere_orientation * vec4(local_camera_orientation * vec3(1.0, 0.0, 0.0), 0.0)),
+            normalize(camera_hypersphere_orientation * vec4(local_camera_orientation * vec3(0.0, 1.0, 0.0), 0.0)),
+            normalize(camera_hypersphere_orientation * vec4(local_camera_orientation * vec3(0.0, 0.0, 1.0), 0.0)),
+            camera_hypersphere_orientation[3]
+        );
+    }
 
-        vec4 view_vector = getLocalDirectionalVector(camera_hypersphere_orientation[3], object_coord);
+    inline vec3 getViewAngles(const mat4 camera_frame, const vec4 object_coord, const float radius)
+    {
+        vec4 camera_right = camera_frame[0];
+        vec4 camera_up = camera_frame[1];
+        vec4 camera_z = camera_frame[2];
+
+        vec4 view_vector = getLocalDirectionalVector(camera_frame[3], object_coord);
         vec4 proj_right = projection(view_vector, camera_right);
         vec4 proj_up = projection(view_vector, camera_up);
         vec4 proj_z = projection(view_vector, camera_z);
@@ -320,7 +409,7 @@ namespace glm::hs
         }
 
 
-        float object_view_distance = distanceOnHypersphere(camera_hypersphere_orientation[3], object_coord, radius);
+        float object_view_distance = distanceOnHypersphere(camera_frame[3], object_coord, radius);
         if (dot(normalize(camera_z), normalize(proj_z)) < 0.0f)
             // if view vector is in the opposite direction as the camera look at vector
         {
@@ -349,6 +438,46 @@ namespace glm::hs
         return vec3(horizontal_angle, vertical_angle, object_view_distance);
     }
 
+    inline vec3 getViewAngles(
+        const mat3 local_camera_orientation,
+        const mat4 camera_hypersphere_orientation,
+        const vec4 object_coord,
+        const float radius
+    )
+    {
+        return getViewAngles(getCameraFrame(local_camera_orientation, camera_hypersphere_orientation), object_coord, radius);
+    }
+
+    // Same as getViewAngles(), but the object coordinate is expressed in the frame of the camera and the angles are
+    // taken with atan2() instead of acos() and branches. Expects an orthonormal camera frame.
+    inline vec3 getViewAnglesAtan2(const mat4 camera_frame, const vec4 object_coord, const float radius)
+    {
+        // object coordinate along camera right, up, z and the camera coordinate
+        vec3 local = vec3(dot(object_coord, camera_frame[0]), dot(object_coord, camera_frame[1]), dot(object_coord, camera_frame[2]));
+        float along_coord = dot(object_coord, camera_frame[3]);
+        float angle = atan(length(local), along_coord);
+
+        // objects behind the camera are seen the long way around the hypersphere, mirrored through the view direction
+        float side = step(0.0f, local.z) * 2.0f - 1.0f;
+        return vec3(
+            atan(side * local.x, side * local.z),
+            atan(side * local.y, side * local.z),
+            radius * (pi() + side * (angle - pi()))
+        );
+    }
+
+    inline vec3 getViewAnglesAtan2(
+        const mat3 local_camera_orientation,
+        const mat4 camera_hypersphere_orientation,
+        const vec4 object_coord,
+        const float radius
+    )
+    {
+        return getViewAnglesAtan2(
+            getCameraFrame(local_camera_orientation, camera_hypersphere_orientation), object_coord, radius
+        );
+    }
+
     inline vec3 getViewSpaceCoords(const vec3 view_angles, const float field_of_view, const float aspect_ratio, const float far_plane)
     {
         float vertical_view_angle = field_of_view / 2;
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <exception>
+#include <algorithm>
+#include <cassert>
+
+namespace thread_pool
+{
+    // Every worker owns a task deque. It takes tasks from the back of its own deque and steals from the
+    // front of the other deques when it runs out of work. The thread that calls parallelFor() helps by
+    // stealing tasks until its job is finished, so nested calls can't dead lock.
+    class ThreadPool
+    {
+    public:
+
+        explicit ThreadPool(const size_t num_worker_threads = std::max<size_t>(std::thread::hardware_concurrency(), 1) - 1)
+        {
+            for (size_t i = 0; i < num_worker_threads; ++i)
+            {
+                m_queues.push_back(std::make_unique<Queue>());
+            }
+            for (size_t i = 0; i < num_worker_threads; ++i)
+            {
+                m_threads.emplace_back([this, i]
+                                       { workerLoop(i); });
+            }
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+
+        void operator=(const ThreadPool&) = delete;
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_sleep_mutex);
+                m_stop = true;
+            }
+            m_wake_up.notify_all();
+            for (auto& thread : m_threads)
+            {
+                thread.join();
+            }
+        }
+
+        // pool that is used if no other pool is given
+        static ThreadPool& getDefault()
+        {
+            static ThreadPool default_pool;
+            return default_pool;
+        }
+
+        [[nodiscard]] size_t numThreads() const
+        {
+            return m_threads.size() + 1;
+        }
+
+        // Calls f(begin, end) for consecutive ranges of at most grain indices that cover [0, size).
+        // Returns when all ranges are done. The first exception thrown by f is rethrown here.
+        template<typename F>
+        void parallelFor(const size_t size, const size_t grain, F f)
+        {
+            auto no_caller_work = []
+            {};
+            parallelForImpl(size, grain, f, no_caller_work, false);
+        }
+
+        // Like parallelFor(), but calls caller_work() on the calling thread once the ranges are queued, so that it
+        // overlaps with the workers. Afterwards the calling thread helps with the ranges. An exception thrown by
+        // caller_work is rethrown after all ranges are done.
+        template<typename F, typename G>
+        void parallelFor(const size_t size, const size_t grain, F f, G caller_work)
+        {
+            parallelForImpl(size, grain, f, caller_work, true);
+        }
+
+    private:
+
+        template<typename F, typename G>
+        void parallelForImpl(const size_t size, const size_t grain, F& f, G& caller_work, const bool has_caller_work)
+        {
+            const size_t chunk_size = std::max<size_t>(grain, 1);
+            const size_t num_chunks = (size + chunk_size - 1) / chunk_size;
+            // without caller work a single range is faster on the calling thread than on a worker
+            if (size == 0 || m_queues.empty() || (num_chunks == 1 && !has_caller_work))
+            {
+                caller_work();
+                if (size > 0)
+                {
+                    f(size_t(0), size);
+                }
+                return;
+            }
+
+            Job job;
+            job.context = &f;
+            job.run = [](void* context, const size_t begin, const size_t end)
+            {
+                (*static_cast<F*>(context))(begin, end);
+            };
+            job.remaining = num_chunks;
+
+            m_num_queued.fetch_add(num_chunks);
+            const size_t first_queue = m_next_queue.fetch_add(1);
+            for (size_t i = 0; i < num_chunks; ++i)
+            {
+                Queue& queue = *m_queues[(first_queue + i) % m_queues.size()];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                queue.tasks.push_back({&job, i * chunk_size, std::min(size, (i + 1) * chunk_size)});
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_sleep_mutex);
+            }
+            m_wake_up.notify_all();
+
+            // the job lives on this stack, so it has to be finished even if caller_work throws
+            std::exception_ptr caller_exception;
+            try
+            {
+                caller_work();
+            }
+            catch (...)
+            {
+                caller_exception = std::current_exception();
+            }
+
+            while (job.remaining.load(std::memory_order_acquire) != 0)
+            {
+                Task task;
+                if (steal(task, m_queues.size()))
+                {
+                    execute(task);
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+
+            if (caller_exception)
+            {
+                std::rethrow_exception(caller_exception);
+            }
+            if (job.exception)
+            {
+                std::rethrow_exception(job.exception);
+            }
+        }
+
+        struct Job
+        {
+            void* context = nullptr;
+            void (* run)(void*, size_t, size_t) = nullptr;
+            std::atomic<size_t> remaining = 0;
+            std::mutex exception_mutex;
+            std::exception_ptr exception;
+        };
+
+        struct Task
+        {
+            Job* job = nullptr;
+            size_t begin = 0;
+            size_t end = 0;
+        };
+
+        struct Queue
+        {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        std::vector<std::unique_ptr<Queue>> m_queues;
+        std::vector<std::thread> m_threads;
+        std::atomic<size_t> m_next_queue = 0;
+        std::atomic<size_t> m_num_queued = 0;
+        std::mutex m_sleep_mutex;
+        std::condition_variable m_wake_up;
+        bool m_stop = false;
+
+        static void execute(const Task& task)
+        {
+            assert(task.job != nullptr);
+            try
+            {
+                task.job->run(task.job->context, task.begin, task.end);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(task.job->exception_mutex);
+                if (!task.job->exception)
+                {
+                    task.job->exception = std::current_exception();
+                }
+            }
+            task.job->remaining.fetch_sub(1, std::memory_order_release);
+        }
+
+        bool pop(const size_t queue_index, Task& task)
+        {
+            Queue& queue = *m_queues[queue_index];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty())
+            {
+                return false;
+            }
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+            m_num_queued.fetch_sub(1);
+            return true;
+        }
+
+        // steals from the front of all queues except the one with own_index
+        bool steal(Task& task, const size_t own_index)
+        {
+            for (size_t i = 1; i <= m_queues.size(); ++i)
+            {
+                const size_t queue_index = (own_index + i) % m_queues.size();
+                if (queue_index == own_index)
+                {
+                    continue;
+                }
+                Queue& queue = *m_queues[queue_index];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (!queue.tasks.empty())
+                {
+                    task = queue.tasks.front();
+                    queue.tasks.pop_front();
+                    m_num_queued.fetch_sub(1);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void workerLoop(const size_t index)
+        {
+            while (true)
+            {
+                Task task;
+                if (pop(index, task) || steal(task, index))
+                {
+                    execute(task);
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(m_sleep_mutex);
+                m_wake_up.wait(lock, [this]
+                { return m_stop || m_num_queued.load() > 0; });
+                if (m_stop && m_num_queued.load() == 0)
+                {
+                    return;
+                }
+            }
+        }
+    };
+}
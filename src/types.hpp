@@ -3,6 +3,7 @@
 
 #include <glm/glm.hpp>
 #include <string>
+#include <filesystem>
 #include "physics_units.hpp"
 
 //TODO: class 3: use own namespace
@@ -26,6 +27,8 @@ STRONG_TYPEDEF(glm::mat3, Orientation3D)
 
 STRONG_TYPEDEF(std::string, Name)
 
+STRONG_TYPEDEF(std::filesystem::path, MeshFile)
+
 STRONG_TYPEDEF(decltype(glm::vec3{1.0f} * physics_units::metre / physics_units::second), Velocity3D)
 
 STRONG_TYPEDEF(physics_units::Metre<glm::vec3>, Position3D)
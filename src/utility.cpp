@@ -6,6 +6,21 @@
 
 namespace utility
 {
+    uint64_t mortonCode(const glm::vec4& v)
+    {
+        uint64_t code = 0;
+        for (int axis = 0; axis < 4; ++axis)
+        {
+            const float normalized = glm::clamp((v[axis] + 1.0f) * 0.5f, 0.0f, 1.0f);
+            const auto quantized = static_cast<uint64_t>(normalized * 65535.0f);
+            for (int bit = 0; bit < 16; ++bit)
+            {
+                code |= ((quantized >> bit) & 1) << (bit * 4 + axis);
+            }
+        }
+        return code;
+    }
+
     std::vector<std::string> split(const std::string& s, const char delimiter)
     {
         std::vector<std::string> elements;
@@ -2,6 +2,7 @@
 
 #include <glm/glm.hpp>
 #include <string>
+#include <cstdint>
 #include <vector>
 #include <filesystem>
 #include "ascii_framebuffer.hpp"
@@ -16,6 +17,9 @@ namespace utility
 
     std::string toString(const glm::vec4& v);
 
+    // Z-order curve key of a point in [-1, 1]^4 with 16 bits per axis. Points with close keys are close in space.
+    uint64_t mortonCode(const glm::vec4& v);
+
 #ifdef USE_ASCII_FRAMEBUFFER
     using namespace ascii_framebuffer;
     inline Framebuffer text_buffer;